@@ -2,169 +2,985 @@
 
 #include "../cnf_grammar/cnf_grammar.hpp"
 #include "../label_decomposed_graph/label_decomposed_graph.hpp"
-#include "cubool.h"
+#include "closure_engine.hpp"
+#include "dyck_engine.hpp"
+#include "matrix_utils.hpp"
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <optional>
+#include <set>
+#include <stdexcept>
 #include <string>
 #include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+template <matrix_backend Backend = default_backend> class matrix_base_algo {
+public:
+  using matrix = typename Backend::matrix;
+  using index = typename Backend::index;
+  using edge = std::tuple<index, std::string, index>;
 
-class matrix_base_algo {
 private:
   cnf_grammar Grammar;
-  label_decomposed_graph Graph;
-  label_decomposed_graph m;
+  // the grammar as read: Grammar holds its indexed (_i) rules only for the
+  // indices that occur among the graph labels
+  cnf_grammar Source;
+  std::set<std::string> indices;
+  label_decomposed_graph<Backend> Graph;
+  label_decomposed_graph<Backend> m;
   using symbol = cnf_grammar::symbol;
+  using utils = matrix_utils<Backend>;
+  bool solved = false;
+
+  // Boolean backends keep the identity of nullable nonterminals implicit:
+  // m[A] only holds the pairs besides the diagonal, A is I + m[A], so
+  // I x B = B is a copy instead of a product and the identity is only
+  // materialised on output. Backends with values keep it explicit, its
+  // entries carry lengths and witnesses.
+  static constexpr bool implicit_identity = !length_backend<Backend>;
+  std::set<std::string> nullable;
+
+  // the grammar taken apart by prepare(): terminal rules A -> x, unit rules
+  // A -> B over nonterminals, and complex rules, aliases resolved in all of
+  // them. Unit rules copy what B gains into A, no product is needed.
+  std::vector<std::pair<symbol, symbol>> terminal_rules, unit_rules;
+  std::vector<std::tuple<symbol, symbol, symbol>> complex_rules;
+  // nonterminals defined by one unit rule only: they stand for the
+  // nonterminal they resolve to and are never materialised
+  std::map<std::string, std::string> aliases;
+
+  std::string resolve(const std::string &nonterm) const {
+    auto it = aliases.find(nonterm);
+    return it == aliases.end() ? nonterm : it->second;
+  }
+
+  void prepare() {
+    std::set<symbol> nonterms = Grammar.non_terminals();
+    std::map<std::string, std::vector<std::string>> unit_targets;
+    std::set<std::string> defined_otherwise;
+    for (const symbol &lhs : Grammar.epsilon_rules_)
+      defined_otherwise.insert(lhs);
+    for (const auto &[lhs, rhs1, rhs2] : Grammar.complex_rules_)
+      defined_otherwise.insert(lhs);
+    for (const auto &[lhs, rhs] : Grammar.simple_rules_)
+      if (nonterms.contains(rhs)) {
+        unit_targets[lhs].push_back(rhs);
+      } else {
+        terminal_rules.emplace_back(lhs, rhs);
+        defined_otherwise.insert(lhs);
+      }
+
+    for (const auto &[lhs, targets] : unit_targets)
+      if (targets.size() == 1 && !defined_otherwise.contains(lhs) &&
+          !Graph.contains(lhs))
+        aliases[lhs] = targets.front();
+    // chains resolve to their end, an alias on a cycle stays a nonterminal
+    for (auto it = aliases.begin(); it != aliases.end();) {
+      std::set<std::string> seen{it->first};
+      std::string target = it->second;
+      while (aliases.contains(target) && !seen.contains(target)) {
+        seen.insert(target);
+        target = aliases.at(target);
+      }
+      if (seen.contains(target)) {
+        it = aliases.erase(it);
+      } else {
+        it->second = target;
+        ++it;
+      }
+    }
+
+    std::set<std::pair<std::string, std::string>> units;
+    for (const auto &[lhs, targets] : unit_targets)
+      if (!aliases.contains(lhs))
+        for (const auto &target : targets)
+          if (resolve(target) != lhs)
+            units.emplace(lhs, resolve(target));
+    for (const auto &[lhs, rhs] : units)
+      unit_rules.emplace_back(lhs, rhs);
+    for (const auto &[lhs, rhs1, rhs2] : Grammar.complex_rules_)
+      complex_rules.emplace_back(lhs, resolve(rhs1), resolve(rhs2));
+  }
+
+  // nonterminals that derive the empty word, from the prepared rules
+  void find_nullable() {
+    for (const symbol &left : Grammar.epsilon_rules_)
+      nullable.insert(left);
+    for (bool changed = true; changed;) {
+      changed = false;
+      for (const auto &[lhs, rhs1, rhs2] : complex_rules)
+        if (nullable.contains(rhs1) && nullable.contains(rhs2))
+          changed |= nullable.insert(lhs).second;
+      for (const auto &[lhs, rhs] : unit_rules)
+        if (nullable.contains(rhs))
+          changed |= nullable.insert(lhs).second;
+    }
+  }
+
+  // m[nonterm] with its implicit identity, owned by the caller
+  matrix materialize(const std::string &nonterm) {
+    std::string name = resolve(nonterm);
+    matrix result = Backend::duplicate(m[name]);
+    if (nullable.contains(name)) {
+      matrix identity = Backend::identity(matrix_size);
+      Backend::accumulate(result, identity);
+      Backend::free(identity);
+    }
+    return result;
+  }
+
+  matrix new_matrix() { return Backend::new_matrix(matrix_size, matrix_size); }
+
+  matrix diagonal(const std::vector<index> &vertices) {
+    return utils::diagonal(matrix_size, vertices);
+  }
+
+  matrix &entry(std::map<std::string, matrix> &matrices,
+                const std::string &key) {
+    return utils::entry(matrices, key, matrix_size);
+  }
+
+  // semi-naive fixpoint over the given complex and unit rules starting from
+  // delta, the new entries already merged into m; delta is consumed. Stops
+  // before a round once stop() holds.
+  void saturate(const std::vector<std::tuple<symbol, symbol, symbol>> &rules,
+                const std::vector<std::pair<symbol, symbol>> &units,
+                std::map<std::string, matrix> delta,
+                const std::function<bool()> &stop) {
+    // rules to wake up when a symbol changes
+    std::map<std::string, std::vector<size_t>> rules_using;
+    for (size_t i = 0; i < rules.size(); i++) {
+      const auto &[lhs, rhs1, rhs2] = rules[i];
+      rules_using[rhs1].push_back(i);
+      if (rhs2.label_ != rhs1.label_)
+        rules_using[rhs2].push_back(i);
+    }
+
+    while (!delta.empty() && !(stop && stop())) {
+      // worklist: only rules with an operand that changed in the last round
+      std::set<size_t> worklist;
+      for (const auto &[label, changes] : delta)
+        if (auto it = rules_using.find(label); it != rules_using.end())
+          worklist.insert(it->second.begin(), it->second.end());
+
+      // products that share their left operand (delta(B) or B) are evaluated
+      // in one pass over it; (lhs, right operand) per group
+      std::map<std::pair<std::string, bool>,
+               std::vector<std::pair<std::string, std::string>>>
+          groups;
+      for (size_t rule : worklist) {
+        const auto &[lhs, rhs1, rhs2] = rules[rule];
+        if (delta.contains(rhs1))
+          groups[{rhs1, true}].emplace_back(lhs, rhs2);
+        if (delta.contains(rhs2))
+          groups[{rhs1, false}].emplace_back(lhs, rhs2);
+      }
+
+      // products go straight into m[lhs], what they add is the next delta;
+      // rules later in the round already see it, which is sound. Every
+      // matrix is looked up here, the batches may run concurrently.
+      std::map<std::string, matrix> next;
+      std::vector<typename utils::batch> batches;
+      for (const auto &[operand, products] : groups) {
+        const auto &[label, is_delta] = operand;
+        auto &batch = batches.emplace_back();
+        batch.left = is_delta ? &delta[label] : &m[label];
+        for (const auto &[lhs, right] : products)
+          batch.targets.push_back({&m[lhs],
+                                   is_delta ? &m[right] : &delta[right],
+                                   &entry(next, lhs)});
+      }
+      auto counts = utils::mxm_add_batches(batches);
+
+      std::map<std::string, size_t> added;
+      size_t b = 0;
+      for (const auto &[operand, products] : groups) {
+        for (size_t i = 0; i < products.size(); i++)
+          added[products[i].first] += counts[b][i];
+        b++;
+      }
+
+      // I x delta(C) and delta(B) x I of nullable operands are copies
+      for (size_t rule : worklist) {
+        const auto &[lhs, rhs1, rhs2] = rules[rule];
+        auto delta1 = delta.find(rhs1), delta2 = delta.find(rhs2);
+        if (delta2 != delta.end() && nullable.contains(rhs1))
+          added[lhs] +=
+              utils::add_new(m[lhs], delta2->second, entry(next, lhs));
+        if (delta1 != delta.end() && nullable.contains(rhs2))
+          added[lhs] +=
+              utils::add_new(m[lhs], delta1->second, entry(next, lhs));
+      }
+      for (const auto &[lhs, rhs] : units)
+        if (auto it = delta.find(rhs); it != delta.end())
+          added[lhs] += utils::add_new(m[lhs], it->second, entry(next, lhs));
+
+      utils::free_all(delta);
+      for (auto &[lhs, fresh] : next)
+        if (added[lhs] != 0)
+          delta[lhs] = fresh;
+        else
+          Backend::free(fresh);
+    }
+    utils::free_all(delta);
+  }
+
+  // epsilon and simple rules, then every stratum; stop() may end it early
+  void fixpoint(const std::function<bool()> &stop) {
+    prepare();
+
+    // for epsilone rules
+    if constexpr (implicit_identity) {
+      find_nullable();
+    } else {
+      matrix identity = Backend::identity(matrix_size);
+      for (const symbol &left : Grammar.epsilon_rules_)
+        Backend::accumulate(m[left], identity);
+      Backend::free(identity);
+    }
+
+    // for simple rules, unit rules are copies inside the strata
+    for (auto &[lhs, rhs] : terminal_rules)
+      Backend::accumulate(m[lhs], Graph[rhs]);
+
+    // Dyck grammars on bidirected graphs skip the fixpoint: S comes from
+    // union-find, every helper X -> S c from one product
+    if constexpr (implicit_identity)
+      if (auto shape = Grammar.dyck(); shape && bidirected(*shape)) {
+        std::vector<matrix> opens;
+        for (const auto &[open, close] : shape->parens)
+          opens.push_back(Graph[open]);
+        symbol start = Grammar.start_nonterm_;
+        matrix result = dyck_engine<Backend>::solve(opens, matrix_size);
+        Backend::free(m[start]);
+        m[start] = result;
+        for (const auto &[lhs, rhs1, rhs2] : shape->helpers) {
+          Backend::mxm_accumulate(m[lhs], m[rhs1], m[rhs2]);
+          if (nullable.contains(rhs1))
+            Backend::accumulate(m[lhs], m[rhs2]);
+          if (nullable.contains(rhs2))
+            Backend::accumulate(m[lhs], m[rhs1]);
+        }
+        return;
+      }
+
+    // rules of one stratum only read finished matrices of lower strata, so
+    // every stratum is saturated once, in topological order
+    std::map<symbol, size_t> stratum_of;
+    auto components = Grammar.strongly_connected_components();
+    for (size_t i = 0; i < components.size(); i++)
+      for (const symbol &s : components[i])
+        stratum_of[s] = i;
+    std::vector<std::vector<std::tuple<symbol, symbol, symbol>>> strata(
+        components.size());
+    std::vector<std::vector<std::pair<symbol, symbol>>> strata_units(
+        components.size());
+    for (const auto &rule : complex_rules)
+      strata[stratum_of[std::get<0>(rule)]].push_back(rule);
+    for (const auto &rule : unit_rules)
+      strata_units[stratum_of[rule.first]].push_back(rule);
+
+    auto closures = Grammar.closure_nonterminals();
+    for (size_t i = 0; i < strata.size(); i++) {
+      // A -> A A | x | eps is the closure of the x edges, no rounds needed;
+      // lengths and witnesses still come from the generic rounds
+      if constexpr (implicit_identity)
+        if (components[i].size() == 1 &&
+            closures.contains(*components[i].begin())) {
+          const symbol &closed = *components[i].begin();
+          for (const auto &[lhs, rhs] : strata_units[i])
+            Backend::accumulate(m[lhs], m[rhs]);
+          matrix result = closure_engine<Backend>::plus(m[closed], matrix_size);
+          Backend::free(m[closed]);
+          m[closed] = result;
+          continue;
+        }
+
+      // everything known before the first round is new
+      std::map<std::string, matrix> delta;
+      auto known = [&](const symbol &s) {
+        if (!delta.contains(s) && Backend::nvals(m[s]) != 0)
+          delta[s] = Backend::duplicate(m[s]);
+      };
+      for (const auto &[lhs, rhs1, rhs2] : strata[i])
+        for (const symbol &s : {lhs, rhs1, rhs2})
+          known(s);
+      for (const auto &[lhs, rhs] : strata_units[i]) {
+        known(lhs);
+        known(rhs);
+      }
+      saturate(strata[i], strata_units[i], std::move(delta), stop);
+    }
+  }
+
+  // whether every open edge of the pairs has its close edge reversed and
+  // back, and no edge is labelled with a nonterminal of the grammar
+  bool bidirected(const cnf_grammar::dyck_shape &shape) {
+    for (const symbol &nonterm : Grammar.non_terminals())
+      if (Graph.contains(nonterm))
+        return false;
+    for (const auto &[open, close] : shape.parens) {
+      if (!Graph.contains(open) && !Graph.contains(close))
+        continue;
+      if (!Graph.contains(open) || !Graph.contains(close))
+        return false;
+      auto reversed = Backend::extract_pairs(Graph[close]);
+      for (auto &[from, to] : reversed)
+        std::swap(from, to);
+      std::sort(reversed.begin(), reversed.end());
+      auto forward = Backend::extract_pairs(Graph[open]);
+      std::sort(forward.begin(), forward.end());
+      if (forward != reversed)
+        return false;
+    }
+    return true;
+  }
+
+  // instantiates the indexed rules for the indices new among the labels,
+  // returns whether there were any; the replaced grammar goes to previous
+  bool instantiate(const std::vector<std::string> &labels,
+                   cnf_grammar *previous = nullptr) {
+    bool added = false;
+    for (const auto &index : Source.indices_in(labels))
+      added |= indices.insert(index).second;
+    if (added) {
+      if (previous != nullptr)
+        *previous = std::move(Grammar);
+      Grammar = Source.instantiate(indices);
+    }
+    return added;
+  }
+
+  // Edges labelled with an aliased nonterminal make it a nonterminal of its
+  // own: the rules are prepared again with the label in the graph, and every
+  // alias that now stands for itself starts from the entries of the
+  // nonterminal it stood for, so the converged matrices stay closed. The
+  // edges themselves are merged by add_edges.
+  void unalias(const std::vector<std::string> &labels) {
+    bool aliased = false;
+    for (const auto &label : labels)
+      if (aliases.contains(label)) {
+        aliased = true;
+        Graph[label];
+      }
+    if (!aliased)
+      return;
+
+    auto old_aliases = std::move(aliases);
+    aliases.clear();
+    terminal_rules.clear();
+    unit_rules.clear();
+    complex_rules.clear();
+    prepare();
+    for (const auto &[nonterm, target] : old_aliases)
+      if (resolve(nonterm) == nonterm)
+        Backend::accumulate(m[nonterm], m[target]);
+    if constexpr (implicit_identity) {
+      nullable.clear();
+      find_nullable();
+    }
+  }
+
+  // Moves a solved instance from the previous grammar to Grammar, which has
+  // rules for new indices on top. The old rules are closed over m, so only
+  // the new ones are applied, once and to the whole matrices; what they add
+  // goes to delta, for saturate to take further. False, with m untouched,
+  // when the new rules change how old nonterminals are stored: an alias
+  // that resolves differently or, with an implicit identity, a nonterminal
+  // that becomes nullable.
+  bool extend(cnf_grammar &previous, std::map<std::string, matrix> &delta) {
+    std::set old_terminals(terminal_rules.begin(), terminal_rules.end());
+    std::set old_units(unit_rules.begin(), unit_rules.end());
+    std::set old_complex(complex_rules.begin(), complex_rules.end());
+    auto old_aliases = std::move(aliases);
+    auto old_nullable = nullable;
+    terminal_rules.clear();
+    unit_rules.clear();
+    complex_rules.clear();
+    aliases.clear();
+    prepare();
+    if constexpr (implicit_identity)
+      find_nullable();
+
+    for (const symbol &nonterm : previous.non_terminals()) {
+      auto old = old_aliases.find(nonterm);
+      if (resolve(nonterm) !=
+          (old == old_aliases.end() ? nonterm.label_ : old->second))
+        return false;
+      if (nullable.contains(nonterm) && !old_nullable.contains(nonterm))
+        return false;
+    }
+
+    if constexpr (!implicit_identity) {
+      std::set<symbol> old_epsilon(previous.epsilon_rules_.begin(),
+                                   previous.epsilon_rules_.end());
+      for (const symbol &lhs : Grammar.epsilon_rules_)
+        if (!old_epsilon.contains(lhs)) {
+          matrix identity = Backend::identity(matrix_size);
+          utils::add_new(m[lhs], identity, entry(delta, lhs));
+          Backend::free(identity);
+        }
+    }
+    for (const auto &rule : terminal_rules)
+      if (!old_terminals.contains(rule))
+        utils::add_new(m[rule.first], Graph[rule.second],
+                       entry(delta, rule.first));
+    for (const auto &rule : unit_rules)
+      if (!old_units.contains(rule))
+        utils::add_new(m[rule.first], m[rule.second],
+                       entry(delta, rule.first));
+    for (const auto &rule : complex_rules)
+      if (!old_complex.contains(rule)) {
+        const auto &[lhs, rhs1, rhs2] = rule;
+        Backend::mxm_add(m[lhs], m[rhs1], m[rhs2], entry(delta, lhs));
+        if (nullable.contains(rhs1))
+          utils::add_new(m[lhs], m[rhs2], entry(delta, lhs));
+        if (nullable.contains(rhs2))
+          utils::add_new(m[lhs], m[rhs1], entry(delta, lhs));
+      }
+    for (auto it = delta.begin(); it != delta.end();)
+      if (Backend::nvals(it->second) == 0) {
+        Backend::free(it->second);
+        it = delta.erase(it);
+      } else {
+        ++it;
+      }
+    return true;
+  }
+
+  // back to the graph itself, as before the first run()
+  void reset() {
+    m = Graph;
+    nullable.clear();
+    terminal_rules.clear();
+    unit_rules.clear();
+    complex_rules.clear();
+    aliases.clear();
+    solved = false;
+  }
+
+  // vertices of the graph are below matrix_size
+  void check_vertex(index vertex) const {
+    if (vertex >= matrix_size)
+      throw std::out_of_range("Vertex " + std::to_string(vertex) +
+                              " outside the graph of " +
+                              std::to_string(matrix_size));
+  }
+
+  // one matrix per label of the edges, owned by the caller; throws
+  // std::out_of_range for an end outside the graph
+  std::map<std::string, matrix> by_label(const std::vector<edge> &edges) {
+    std::map<std::string, std::pair<std::vector<index>, std::vector<index>>>
+        ends;
+    for (const auto &[from, label, to] : edges) {
+      check_vertex(from);
+      check_vertex(to);
+    }
+    for (const auto &[from, label, to] : edges) {
+      ends[label].first.push_back(from);
+      ends[label].second.push_back(to);
+    }
+    std::map<std::string, matrix> result;
+    for (auto &[label, vertices] : ends) {
+      auto &[rows, cols] = vertices;
+      result[label] = new_matrix();
+      Backend::build(result[label], rows.data(), cols.data(), rows.size());
+    }
+    return result;
+  }
+
+  // vertices reachable from `from` over edges of any label that also reach
+  // `to`, every path from `from` to `to` stays inside them
+  std::vector<bool> between(index from, index to) {
+    std::vector<std::vector<index>> successors(matrix_size),
+        predecessors(matrix_size);
+    for (const auto &label : Graph.labels())
+      for (auto [v, u] : Backend::extract_pairs(Graph[label])) {
+        successors[v].push_back(u);
+        predecessors[u].push_back(v);
+      }
+
+    auto reachable = [&](index start,
+                         const std::vector<std::vector<index>> &next) {
+      std::vector<bool> seen(matrix_size, false);
+      std::vector<index> stack{start};
+      seen[start] = true;
+      while (!stack.empty()) {
+        index v = stack.back();
+        stack.pop_back();
+        for (index u : next[v])
+          if (!seen[u]) {
+            seen[u] = true;
+            stack.push_back(u);
+          }
+      }
+      return seen;
+    };
+    std::vector<bool> result = reachable(from, successors);
+    std::vector<bool> backward = reachable(to, predecessors);
+    for (size_t v = 0; v < matrix_size; v++)
+      result[v] = result[v] && backward[v];
+    return result;
+  }
 
 public:
   size_t matrix_size{};
 
   matrix_base_algo() {}
   matrix_base_algo(const cnf_grammar &grammar,
-                   const label_decomposed_graph &graph)
-      : Grammar(grammar), Graph(graph) {}
+                   const label_decomposed_graph<Backend> &graph)
+      : Source(grammar), Graph(graph), m(graph),
+        matrix_size(graph.matrix_size) {
+    Grammar = Source.instantiate(indices);
+    instantiate(Graph.labels());
+  }
 
   matrix_base_algo(const std::string &path_to_gramar,
-                   const std::string &path_to_graph) {
-    Grammar = *(new cnf_grammar(path_to_gramar));
-    Graph = *(new label_decomposed_graph(path_to_graph));
-    matrix_size = Graph.matrix_size;
-    m = *(new label_decomposed_graph(Graph));
-  }
-
-  cuBool_Matrix solve() {
-    // check resutls
-    cuBool_Index tc_rows[matrix_size * matrix_size],
-        tc_cols[matrix_size * matrix_size];
-    cuBool_Index nvals;
-    /*
-    std::cout << "a : " << std::endl;
-    cuBool_Matrix_Nvals(Graph["a"], &nvals);
-    cuBool_Matrix_ExtractPairs(Graph["a"], tc_rows, tc_cols, &nvals);
-    for (cuBool_Index i = 0; i < nvals; i++)
-      printf("(%u,%u)\n", tc_rows[i], tc_cols[i]);
-    std::cout << "b : " << std::endl;
-    // check resutls
-    cuBool_Matrix_Nvals(Graph["b"], &nvals);
-    cuBool_Matrix_ExtractPairs(Graph["b"], tc_rows, tc_cols, &nvals);
-    for (cuBool_Index i = 0; i < nvals; i++)
-      printf("(%u,%u)\n", tc_rows[i], tc_cols[i]);
-    */
-    /*
-    std::cout << "A : " << std::endl;
-    cuBool_Matrix_Nvals(m["A"], &nvals);
-    cuBool_Matrix_ExtractPairs(m["A"], tc_rows, tc_cols, &nvals);
-    for (cuBool_Index i = 0; i < nvals; i++)
-      printf("(%u,%u)\n", tc_rows[i], tc_cols[i]);
-    std::cout << std::endl;
-*/
-
-    std::vector<cuBool_Matrix> results;
-    std::set<cuBool_Matrix> uniq_results;
-    results.emplace_back();
-    cuBool_Matrix_New(&results.back(), matrix_size, matrix_size);
-    uniq_results.insert(results.back());
+                   const std::string &path_to_graph)
+      : Source(path_to_gramar), Graph(path_to_graph), m(Graph),
+        matrix_size(Graph.matrix_size) {
+    Grammar = Source.instantiate(indices);
+    instantiate(Graph.labels());
+  }
 
-    // for epsilone rules
-    std::vector<cuBool_Index> rows;
-    std::vector<cuBool_Index> cols;
-    for (int i = 0; i < matrix_size; i++) {
-      rows.push_back(i);
-      cols.push_back(i);
-    }
-    for (const symbol &left : Grammar.epsilon_rules_) {
-      cuBool_Matrix_Build(m[left], rows.data(), cols.data(), matrix_size,
-                          CUBOOL_HINT_NO);
-    }
-
-    // for simple rules
-    results.emplace_back();
-    cuBool_Matrix_New(&results.back(), matrix_size, matrix_size);
-    uniq_results.insert(results.back());
-    for (auto &[lhs, rhs] : Grammar.simple_rules_) {
-      cuBool_Matrix_EWiseAdd(results.back(), m[lhs], Graph[rhs],
-                             CUBOOL_HINT_NO);
-      m[lhs] = results.back();
-    }
-
-    // core cycle
-    bool changed = true;
-    cuBool_Index old_nvals;
-    results.emplace_back();
-    auto result = results.back();
-    cuBool_Matrix_New(&result, matrix_size, matrix_size);
-    uniq_results.insert(result);
-    results.emplace_back();
-    auto result2 = results.back();
-    cuBool_Matrix_New(&result2, matrix_size, matrix_size);
-    uniq_results.insert(result2);
-    while (changed) {
-      changed = false;
-      for (auto &[lhs, rhs1, rhs2] : Grammar.complex_rules_) {
-        cuBool_Matrix_New(&result, matrix_size, matrix_size);
-        cuBool_Matrix_New(&result2, matrix_size, matrix_size);
-        /*
-        std::cout << lhs.label_ << "->" << rhs1.label_ << '+' << rhs2.label_
-                  << std::endl;
-        */
-        cuBool_Matrix_Nvals(m[lhs], &old_nvals);
-        cuBool_MxM(result, m[rhs1], m[rhs2], CUBOOL_HINT_NO);
-        /*
-        std::cout << rhs1.label_ << " : " << std::endl;
-        // check resutls
-        cuBool_Matrix_Nvals(m[rhs1], &nvals);
-        cuBool_Matrix_ExtractPairs(m[rhs1], tc_rows, tc_cols, &nvals);
-        for (cuBool_Index i = 0; i < nvals; i++)
-          printf("(%u,%u)\n", tc_rows[i], tc_cols[i]);
-        std::cout << rhs2.label_ << " : " << std::endl;
-        // check resutls
-        cuBool_Matrix_Nvals(m[rhs2], &nvals);
-        cuBool_Matrix_ExtractPairs(m[rhs2], tc_rows, tc_cols, &nvals);
-        for (cuBool_Index i = 0; i < nvals; i++)
-          printf("(%u,%u)\n", tc_rows[i], tc_cols[i]);
-
-        std::cout << lhs.label_ << " : " << std::endl;
-        // check resutls
-        cuBool_Matrix_Nvals(m[lhs], &nvals);
-        cuBool_Matrix_ExtractPairs(m[lhs], tc_rows, tc_cols, &nvals);
-        for (cuBool_Index i = 0; i < nvals; i++)
-          printf("(%u,%u)\n", tc_rows[i], tc_cols[i]);
-
-        std::cout << "result of mxm : " << std::endl;
-        // check resutls
-        cuBool_Matrix_Nvals(result, &nvals);
-        cuBool_Matrix_ExtractPairs(result, tc_rows, tc_cols, &nvals);
-        for (cuBool_Index i = 0; i < nvals; i++)
-          printf("(%u,%u)\n", tc_rows[i], tc_cols[i]);
-        */
-
-        cuBool_Matrix_EWiseAdd(result2, m[lhs], result, CUBOOL_HINT_NO);
-        m[lhs] = result2;
-        /*
-        std::cout << "result of ewiseAdd : " << std::endl;
-        // check resutls
-        cuBool_Matrix_Nvals(result2, &nvals);
-        cuBool_Matrix_ExtractPairs(result2, tc_rows, tc_cols, &nvals);
-        for (cuBool_Index i = 0; i < nvals; i++)
-          printf("(%u,%u)\n", tc_rows[i], tc_cols[i]);
-        */
-
-        cuBool_Index new_nvals;
-
-        cuBool_Matrix_Nvals(m[lhs], &new_nvals);
-        changed |= !(old_nvals == new_nvals);
-      }
-    }
-    for (auto result : uniq_results)
-      if (m[Grammar.start_nonterm_] != result)
-        cuBool_Matrix_Free(result);
-
-    /*
-    // check resutls
-    std::cout << "S : " << std::endl;
-    cuBool_Matrix_Nvals(m["S"], &nvals);
-    cuBool_Matrix_ExtractPairs(m["S"], tc_rows, tc_cols, &nvals);
-    for (cuBool_Index i = 0; i < nvals; i++)
-      printf("(%u,%u)\n", tc_rows[i], tc_cols[i]);
-    */
-    return m[Grammar.start_nonterm_];
+  // Semi-naive fixpoint: every round only multiplies the pairs derived in the
+  // previous round (delta) by the accumulated matrices, so each pair of
+  // operands is combined once instead of once per round. Runs once, later
+  // calls reuse the converged matrices.
+  void run() {
+    if (solved)
+      return;
+    solved = true;
+
+    fixpoint({});
+  }
+
+  // Inserts labelled edges, vertices have to be below matrix_size or
+  // std::out_of_range is thrown before anything changes. A solved instance
+  // is updated from the new edges only: the entries they add to terminal
+  // and simple-rule matrices are the first delta of one more semi-naive
+  // pass over all complex and unit rules, starting from the converged
+  // matrices. A label named like an aliased nonterminal makes it a
+  // nonterminal of its own first (see unalias()). An index seen for the
+  // first time brings rules the instance was not solved with: they are
+  // applied once to the converged matrices and join the delta (see
+  // extend()). Only when they change an alias or make an old nonterminal
+  // nullable is the instance solved again from the graph.
+  void add_edges(const std::vector<edge> &edges) {
+    std::map<std::string, matrix> inserted = by_label(edges);
+    std::vector<std::string> labels;
+    for (const auto &[label, added] : inserted)
+      labels.push_back(label);
+    if (solved)
+      unalias(labels);
+    std::map<std::string, matrix> delta;
+    cnf_grammar previous;
+    if (instantiate(labels, &previous) && solved &&
+        !extend(previous, delta)) {
+      for (auto &[label, added] : inserted)
+        Backend::accumulate(Graph[label], added);
+      utils::free_all(inserted);
+      utils::free_all(delta);
+      reset();
+      run();
+      return;
+    }
+
+    auto merge = [&](const std::string &label, matrix entries) {
+      matrix fresh = Backend::difference(entries, m[label]);
+      if (Backend::nvals(fresh) != 0) {
+        Backend::accumulate(m[label], fresh);
+        Backend::accumulate(entry(delta, label), fresh);
+      }
+      Backend::free(fresh);
+    };
+    for (auto &[label, added] : inserted) {
+      Backend::accumulate(Graph[label], added);
+      merge(label, added);
+      if (solved)
+        for (const auto &[lhs, rhs] : terminal_rules)
+          if (rhs.label_ == label)
+            merge(lhs, added);
+    }
+    utils::free_all(inserted);
+
+    if (solved)
+      saturate(complex_rules, unit_rules, std::move(delta), {});
+    else
+      utils::free_all(delta);
+  }
+
+  // Removes labelled edges, DRed style. Every entry with a derivation that
+  // uses a removed entry is deleted first (over-deletion, computed on the
+  // matrices before the removal). Deleted entries that still have a
+  // derivation from what is left are put back, and the semi-naive pass of
+  // add_edges derives the rest from them. Vertices are checked like in
+  // add_edges.
+  void remove_edges(const std::vector<edge> &edges) {
+    std::map<std::string, matrix> removed = by_label(edges);
+    if (!solved) {
+      for (auto &[label, gone] : removed) {
+        utils::remove(Graph[label], gone);
+        utils::remove(m[label], gone);
+      }
+      utils::free_all(removed);
+      return;
+    }
+
+    // over-deletion, m is not changed until it is done
+    std::map<std::string, matrix> deleted, next;
+    auto over_delete = [&](const std::string &label, matrix candidates) {
+      matrix known = Backend::intersect(m[label], candidates);
+      matrix fresh = Backend::difference(known, entry(deleted, label));
+      Backend::free(known);
+      if (Backend::nvals(fresh) != 0) {
+        Backend::accumulate(deleted[label], fresh);
+        Backend::accumulate(entry(next, label), fresh);
+      }
+      Backend::free(fresh);
+    };
+    for (auto &[label, gone] : removed) {
+      over_delete(label, gone);
+      for (const auto &[lhs, rhs] : terminal_rules)
+        if (rhs.label_ == label)
+          over_delete(lhs, gone);
+    }
+    while (!next.empty()) {
+      std::map<std::string, matrix> delta = std::move(next);
+      next.clear();
+      for (const auto &[lhs, rhs] : unit_rules)
+        if (auto it = delta.find(rhs); it != delta.end())
+          over_delete(lhs, it->second);
+      for (const auto &[lhs, rhs1, rhs2] : complex_rules) {
+        auto delta1 = delta.find(rhs1), delta2 = delta.find(rhs2);
+        if (delta1 == delta.end() && delta2 == delta.end())
+          continue;
+        matrix product = new_matrix();
+        if (delta1 != delta.end())
+          Backend::mxm_accumulate(product, delta1->second, m[rhs2]);
+        if (delta2 != delta.end())
+          Backend::mxm_accumulate(product, m[rhs1], delta2->second);
+        if (delta1 != delta.end() && nullable.contains(rhs2))
+          Backend::accumulate(product, delta1->second);
+        if (delta2 != delta.end() && nullable.contains(rhs1))
+          Backend::accumulate(product, delta2->second);
+        over_delete(lhs, product);
+        Backend::free(product);
+      }
+      utils::free_all(delta);
+    }
+
+    for (auto &[label, gone] : removed)
+      utils::remove(Graph[label], gone);
+    for (auto &[label, gone] : deleted)
+      utils::remove(m[label], gone);
+    utils::free_all(removed);
+
+    // deleted entries with a derivation in one step from what is left
+    std::map<std::string, matrix> rederived;
+    auto rederive = [&](const std::string &label, matrix candidates) {
+      matrix back = Backend::intersect(candidates, deleted[label]);
+      Backend::accumulate(entry(rederived, label), back);
+      Backend::free(back);
+    };
+    matrix identity = Backend::identity(matrix_size);
+    for (const symbol &lhs : Grammar.epsilon_rules_)
+      if (deleted.contains(lhs))
+        rederive(lhs, identity);
+    Backend::free(identity);
+    for (const auto &[label, gone] : deleted)
+      if (Graph.contains(label))
+        rederive(label, Graph[label]);
+    for (const auto &[lhs, rhs] : terminal_rules)
+      if (deleted.contains(lhs))
+        rederive(lhs, Graph[rhs]);
+    for (const auto &[lhs, rhs] : unit_rules)
+      if (deleted.contains(lhs))
+        rederive(lhs, m[rhs]);
+    for (const auto &[lhs, rhs1, rhs2] : complex_rules)
+      if (deleted.contains(lhs)) {
+        matrix product = new_matrix();
+        Backend::mxm_accumulate(product, m[rhs1], m[rhs2]);
+        if (nullable.contains(rhs2))
+          Backend::accumulate(product, m[rhs1]);
+        if (nullable.contains(rhs1))
+          Backend::accumulate(product, m[rhs2]);
+        rederive(lhs, product);
+        Backend::free(product);
+      }
+    utils::free_all(deleted);
+
+    saturate(complex_rules, unit_rules, utils::merge_new(m, rederived), {});
+  }
+
+  // Point query: whether the start nonterminal derives a path from -> to.
+  // Only edges between vertices that are reachable from `from` and reach `to`
+  // can take part in such a derivation, so the fixpoint runs on that part of
+  // the graph and stops as soon as the pair appears. Vertices outside the
+  // graph throw std::out_of_range.
+  bool query(index from, index to) {
+    check_vertex(from);
+    check_vertex(to);
+    std::string start = Grammar.start_nonterm_;
+    if (solved)
+      return (from == to && nullable.contains(resolve(start))) ||
+             utils::contains(m[resolve(start)], from, to, matrix_size);
+
+    std::vector<bool> relevant = between(from, to);
+    label_decomposed_graph<Backend> restricted(matrix_size);
+    for (const auto &label : Graph.labels()) {
+      std::vector<index> rows, cols;
+      for (auto [v, u] : Backend::extract_pairs(Graph[label]))
+        if (relevant[v] && relevant[u]) {
+          rows.push_back(v);
+          cols.push_back(u);
+        }
+      Backend::build(restricted[label], rows.data(), cols.data(),
+                     rows.size());
+    }
+
+    matrix_base_algo part(Grammar, restricted);
+    auto found = [&] {
+      std::string name = part.resolve(start);
+      return (from == to && part.nullable.contains(name)) ||
+             utils::contains(part.m[name], from, to, matrix_size);
+    };
+    part.fixpoint(found);
+    return found();
+  }
+
+  // Returned matrix is owned by the caller.
+  matrix solve() {
+    run();
+    return materialize(Grammar.start_nonterm_);
+  }
+
+  // every nonterminal from the same fixpoint, matrices are owned by the caller
+  std::map<std::string, matrix> solve_all() {
+    std::vector<std::string> nonterms;
+    for (const symbol &nonterm : Grammar.non_terminals())
+      nonterms.push_back(nonterm);
+    return solve_all(nonterms);
+  }
+
+  std::map<std::string, matrix>
+  solve_all(const std::vector<std::string> &nonterms) {
+    run();
+    std::map<std::string, matrix> result;
+    for (const auto &nonterm : nonterms)
+      result[nonterm] = materialize(nonterm);
+    return result;
+  }
+
+  // Multiple-source CFPQ: only pairs (s, v) with s in sources are computed.
+  // Every nonterminal A gets a row mask Src[A] of the vertices it is queried
+  // from, Src[start] = sources, and for A -> B C: Src[B] |= Src[A],
+  // Src[C] |= columns of Src[A] x B. Rows of A outside Src[A] are never
+  // produced. Masks and matrices grow together in one semi-naive loop.
+  // Returned matrix is owned by the caller, sources outside the graph throw
+  // std::out_of_range.
+  matrix solve(const std::vector<index> &sources) {
+    for (index source : sources)
+      check_vertex(source);
+    std::set<symbol> nonterms = Grammar.non_terminals();
+    label_decomposed_graph<Backend> t(matrix_size);
+    label_decomposed_graph<Backend> src(matrix_size);
+    auto operand = [&](const symbol &s) -> matrix & {
+      return nonterms.contains(s) ? t[s] : Graph[s];
+    };
+
+    // a graph label named like a nonterminal is part of it
+    std::vector<std::pair<symbol, symbol>> simple_rules, units;
+    for (const auto &[lhs, rhs] : Grammar.simple_rules_)
+      (nonterms.contains(rhs) ? units : simple_rules).emplace_back(lhs, rhs);
+    for (const symbol &nonterm : nonterms)
+      if (Graph.contains(nonterm))
+        simple_rules.emplace_back(nonterm, nonterm);
+
+    std::map<std::string, matrix> delta, src_delta;
+    std::map<std::string, matrix> derived, derived_src;
+    derived_src[Grammar.start_nonterm_] = diagonal(sources);
+    src_delta = utils::merge_new(src, derived_src);
+
+    while (!delta.empty() || !src_delta.empty()) {
+      // terminal and epsilon rules only matter for newly queried rows
+      for (const symbol &lhs : Grammar.epsilon_rules_)
+        if (auto it = src_delta.find(lhs); it != src_delta.end())
+          Backend::accumulate(entry(derived, lhs), it->second);
+      for (const auto &[lhs, rhs] : simple_rules)
+        if (auto it = src_delta.find(lhs); it != src_delta.end())
+          Backend::mxm_accumulate(entry(derived, lhs), it->second, Graph[rhs]);
+
+      // A -> B: B is queried from the rows of A, A takes those rows of B
+      for (const auto &[lhs, rhs] : units) {
+        if (auto it = src_delta.find(lhs); it != src_delta.end()) {
+          Backend::accumulate(entry(derived_src, rhs), it->second);
+          Backend::mxm_accumulate(entry(derived, lhs), it->second, t[rhs]);
+        }
+        if (auto it = delta.find(rhs); it != delta.end())
+          Backend::mxm_accumulate(entry(derived, lhs), src[lhs], it->second);
+      }
+
+      for (const auto &[lhs, rhs1, rhs2] : Grammar.complex_rules_) {
+        auto delta_src = src_delta.find(lhs);
+        auto delta1 = delta.find(rhs1), delta2 = delta.find(rhs2);
+        if (delta_src == src_delta.end() && delta1 == delta.end() &&
+            delta2 == delta.end())
+          continue;
+
+        // Src[A] x B, only the part that involves a delta
+        matrix left = new_matrix();
+        if (delta_src != src_delta.end()) {
+          Backend::mxm_accumulate(left, delta_src->second, operand(rhs1));
+          if (nonterms.contains(rhs1))
+            Backend::accumulate(entry(derived_src, rhs1), delta_src->second);
+        }
+        if (delta1 != delta.end())
+          Backend::mxm_accumulate(left, src[lhs], delta1->second);
+        if (Backend::nvals(left) != 0) {
+          Backend::mxm_accumulate(entry(derived, lhs), left, operand(rhs2));
+          if (nonterms.contains(rhs2)) {
+            matrix columns = Backend::column_mask(left);
+            Backend::accumulate(entry(derived_src, rhs2), columns);
+            Backend::free(columns);
+          }
+        }
+        Backend::free(left);
+
+        if (delta2 != delta.end()) {
+          matrix full_left = new_matrix();
+          Backend::mxm_accumulate(full_left, src[lhs], operand(rhs1));
+          Backend::mxm_accumulate(entry(derived, lhs), full_left,
+                                  delta2->second);
+          Backend::free(full_left);
+        }
+      }
+
+      utils::free_all(delta);
+      utils::free_all(src_delta);
+      delta = utils::merge_new(t, derived);
+      src_delta = utils::merge_new(src, derived_src);
+    }
+
+    matrix result = new_matrix();
+    matrix rows = diagonal(sources);
+    Backend::mxm_accumulate(result, rows, t[Grammar.start_nonterm_]);
+    Backend::free(rows);
+    return result;
+  }
+  // length of the path stored for (from, to) of nonterm: the shortest one
+  // with tropical_backend, the first derived one with single_path_backend
+  std::optional<size_t> path_length(const std::string &nonterm, index from,
+                                    index to)
+    requires length_backend<Backend>
+  {
+    run();
+    auto found = Backend::get(m[resolve(nonterm)], from, to);
+    if (found == nullptr)
+      return std::nullopt;
+    return found->length;
+  }
+
+  std::optional<size_t> path_length(index from, index to)
+    requires length_backend<Backend>
+  {
+    return path_length(Grammar.start_nonterm_, from, to);
   }
+
+  // One path from `from` to `to` whose labels form a word derived from
+  // nonterm, rebuilt from the derivations a witness backend stored during
+  // solve(). nullopt when the pair is not derived.
+  std::optional<std::vector<edge>> witness(const std::string &nonterm,
+                                           index from, index to)
+    requires witness_backend<Backend>
+  {
+    run();
+    std::string name = resolve(nonterm);
+    auto found = Backend::get(m[name], from, to);
+    if (found == nullptr)
+      return std::nullopt;
+
+    // (nonterm, i, j, value) still to expand, leftmost on top
+    using value = std::remove_cvref_t<decltype(*found)>;
+    std::vector<std::tuple<std::string, index, index, value>> stack{
+        {name, from, to, *found}};
+    std::vector<edge> path;
+
+    // expands (lhs, i, j) if v was derived there rather than copied in
+    auto expand = [&](const std::string &lhs, index i, index j,
+                      const value &v) {
+      if (v.middle == Backend::semiring::no_middle) {
+        if (v.length == 0)
+          return true;
+        // an edge labelled with the nonterminal itself or a terminal rule
+        std::vector<std::string> labels{lhs};
+        for (const auto &[rule_lhs, rhs] : terminal_rules)
+          if (rule_lhs.label_ == lhs)
+            labels.push_back(rhs);
+        for (const auto &label : labels)
+          if (Graph.contains(label) &&
+              Backend::get(Graph[label], i, j) != nullptr) {
+            path.emplace_back(i, label, j);
+            return true;
+          }
+        return false;
+      }
+
+      // a rule whose operands were both derived before this pair
+      index k = v.middle;
+      for (const auto &[rule_lhs, rhs1, rhs2] : complex_rules) {
+        if (rule_lhs.label_ != lhs)
+          continue;
+        auto left = Backend::get(m[rhs1], i, k);
+        auto right = Backend::get(m[rhs2], k, j);
+        if (left != nullptr && right != nullptr && left->height < v.height &&
+            right->height < v.height &&
+            left->length + right->length == v.length) {
+          stack.emplace_back(rhs2, k, j, *right);
+          stack.emplace_back(rhs1, i, k, *left);
+          return true;
+        }
+      }
+      return false;
+    };
+
+    while (!stack.empty()) {
+      auto [lhs, i, j, v] = stack.back();
+      stack.pop_back();
+      // otherwise the value came along unit rules from a nonterminal that
+      // holds it too and derived it
+      std::vector<std::string> queue{lhs};
+      std::set<std::string> seen{lhs};
+      bool expanded = false;
+      for (size_t q = 0; q < queue.size(); q++) {
+        if ((expanded = expand(queue[q], i, j, v)))
+          break;
+        for (const auto &[rule_lhs, rhs] : unit_rules) {
+          if (rule_lhs.label_ != queue[q] || seen.contains(rhs))
+            continue;
+          auto copied = Backend::get(m[rhs], i, j);
+          if (copied != nullptr && copied->length == v.length &&
+              copied->height == v.height && copied->middle == v.middle) {
+            seen.insert(rhs);
+            queue.push_back(rhs);
+          }
+        }
+      }
+      // no derivation explains the entry, a partial path is no witness
+      if (!expanded)
+        return std::nullopt;
+    }
+    return path;
+  }
+
+  std::optional<std::vector<edge>> witness(index from, index to)
+    requires witness_backend<Backend>
+  {
+    return witness(Grammar.start_nonterm_, from, to);
+  }
+
   ~matrix_base_algo() {}
 };
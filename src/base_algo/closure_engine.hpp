@@ -0,0 +1,101 @@
+#pragma once
+
+#include "../bit_matrix/bit_matrix.hpp"
+#include "../label_decomposed_graph/label_decomposed_graph.hpp"
+#include "matrix_utils.hpp"
+#include <algorithm>
+#include <limits>
+#include <utility>
+#include <vector>
+
+// Transitive closure of a boolean matrix on the host, for nonterminals shaped
+// A -> A A | x | eps. The strongly connected components of the edges are
+// condensed, then every component ORs together the reachable sets of its
+// successors, one bit row per component, sinks first.
+template <matrix_backend Backend> struct closure_engine {
+  using matrix = typename Backend::matrix;
+  using index = typename Backend::index;
+
+  // (u, v) for every path of at least one edge of m from u to v, owned by the
+  // caller
+  static matrix plus(matrix m, size_t size) {
+    std::vector<std::vector<index>> next(size);
+    for (auto [u, v] : Backend::extract_pairs(m))
+      next[u].push_back(v);
+
+    // iterative Tarjan, components come out after every component they reach
+    constexpr size_t unvisited = std::numeric_limits<size_t>::max();
+    std::vector<size_t> order(size, unvisited), low(size),
+        component(size, unvisited);
+    std::vector<std::vector<index>> members;
+    std::vector<index> stack;
+    // vertex and its next successor to look at
+    std::vector<std::pair<index, size_t>> calls;
+    size_t counter = 0;
+    for (index root = 0; root < size; root++) {
+      if (order[root] != unvisited)
+        continue;
+      order[root] = low[root] = counter++;
+      stack.push_back(root);
+      calls.emplace_back(root, 0);
+      while (!calls.empty()) {
+        auto &[v, edge] = calls.back();
+        if (edge < next[v].size()) {
+          index u = next[v][edge++];
+          if (order[u] == unvisited) {
+            order[u] = low[u] = counter++;
+            stack.push_back(u);
+            calls.emplace_back(u, 0);
+          } else if (component[u] == unvisited) {
+            low[v] = std::min(low[v], order[u]);
+          }
+          continue;
+        }
+
+        index done = v;
+        calls.pop_back();
+        if (!calls.empty())
+          low[calls.back().first] = std::min(low[calls.back().first], low[done]);
+        if (low[done] != order[done])
+          continue;
+        members.emplace_back();
+        index w;
+        do {
+          w = stack.back();
+          stack.pop_back();
+          component[w] = members.size() - 1;
+          members.back().push_back(w);
+        } while (w != done);
+      }
+    }
+
+    // reach row c: vertices at the end of a nonempty path from component c
+    bit_matrix reach(members.size(), size);
+    std::vector<size_t> merged(members.size(), unvisited);
+    for (size_t c = 0; c < members.size(); c++) {
+      bool cyclic = members[c].size() > 1;
+      for (index v : members[c])
+        for (index u : next[v]) {
+          size_t d = component[u];
+          if (d == c) {
+            cyclic = true;
+          } else if (merged[d] != c) {
+            merged[d] = c;
+            reach.set(c, u);
+            bit_kernels::or_words(reach.row(c), reach.row(d),
+                                  reach.words_per_row());
+          }
+        }
+      if (cyclic)
+        for (index v : members[c])
+          reach.set(c, v);
+    }
+
+    // every member of a component gets its reach row
+    return matrix_utils<Backend>::from_bit_rows(size, [&](auto put) {
+      for (size_t c = 0; c < members.size(); c++)
+        for (index v : members[c])
+          put(v, reach.row(c));
+    });
+  }
+};
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "../bit_matrix/bit_matrix.hpp"
+#include "../label_decomposed_graph/label_decomposed_graph.hpp"
+#include "matrix_utils.hpp"
+#include <algorithm>
+#include <map>
+#include <numeric>
+#include <utility>
+#include <vector>
+
+// Dyck reachability on a bidirected graph: every open edge u -> v comes with
+// the close edge v -> u of its pair. Balanced paths are then symmetric and
+// transitive, so reachability is an equivalence, built with union-find: two
+// vertices with an open edge of the same pair into one class are balanced
+// to each other (x ( C ) z), which may merge more classes in turn. Near
+// linear in the number of edges instead of a cubic fixpoint.
+template <matrix_backend Backend> struct dyck_engine {
+  using matrix = typename Backend::matrix;
+  using index = typename Backend::index;
+
+  // (u, v) for every nonempty balanced path from u to v, given the open
+  // edges of every pair; owned by the caller
+  static matrix solve(const std::vector<matrix> &opens, size_t size) {
+    std::vector<index> parent(size);
+    std::iota(parent.begin(), parent.end(), 0);
+    auto find = [&](index v) {
+      while (parent[v] != v)
+        v = parent[v] = parent[parent[v]];
+      return v;
+    };
+
+    // per class root: pair -> one source of an open edge into the class
+    std::vector<std::map<size_t, index>> entered(size);
+    std::vector<bool> opens_pair(size, false);
+    std::vector<std::pair<index, index>> unite;
+    auto enter = [&](index root, size_t pair, index source) {
+      auto [it, inserted] = entered[root].try_emplace(pair, source);
+      if (!inserted)
+        unite.emplace_back(it->second, source);
+    };
+    for (size_t pair = 0; pair < opens.size(); pair++)
+      for (auto [from, to] : Backend::extract_pairs(opens[pair])) {
+        opens_pair[from] = true;
+        enter(to, pair, from);
+      }
+
+    while (!unite.empty()) {
+      auto [a, b] = unite.back();
+      unite.pop_back();
+      a = find(a);
+      b = find(b);
+      if (a == b)
+        continue;
+      // the smaller map moves
+      if (entered[a].size() < entered[b].size())
+        std::swap(a, b);
+      parent[b] = a;
+      for (auto [pair, source] : entered[b])
+        enter(a, pair, source);
+      entered[b].clear();
+    }
+
+    std::vector<std::vector<index>> classes(size);
+    for (index v = 0; v < size; v++)
+      classes[find(v)].push_back(v);
+    // every member of a class gets the class as its row, one buffer is
+    // filled and cleared per class
+    using word = bit_matrix::word;
+    std::vector<word> bits((size + 63) / 64, 0);
+    return matrix_utils<Backend>::from_bit_rows(size, [&](auto put) {
+      for (const auto &members : classes) {
+        // a lone vertex only returns to itself over one of its own pairs
+        if (members.empty() ||
+            (members.size() == 1 && !opens_pair[members.front()]))
+          continue;
+        for (index v : members)
+          bits[v / 64] |= word{1} << (v % 64);
+        for (index u : members)
+          put(u, bits.data());
+        for (index v : members)
+          bits[v / 64] = 0;
+      }
+    });
+  }
+};
@@ -0,0 +1,263 @@
+#pragma once
+
+#include "../bit_matrix/bit_matrix.hpp"
+#include "../label_decomposed_graph/label_decomposed_graph.hpp"
+#include "../thread_pool/thread_pool.hpp"
+#include <algorithm>
+#include <bit>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+// helpers shared by the fixpoint engines, all matrices are size x size
+template <matrix_backend Backend> struct matrix_utils {
+  using matrix = typename Backend::matrix;
+  using index = typename Backend::index;
+
+  static matrix diagonal(size_t size, std::vector<index> vertices) {
+    std::sort(vertices.begin(), vertices.end());
+    vertices.erase(std::unique(vertices.begin(), vertices.end()),
+                   vertices.end());
+    matrix result = Backend::new_matrix(size, size);
+    Backend::build(result, vertices.data(), vertices.data(), vertices.size());
+    return result;
+  }
+
+  // size x size matrix from packed bit rows: emit(put) calls put(v, bits)
+  // for the rows it has, bits packed like a bit_matrix row of size columns.
+  // Backends with or_row take the words as they are, others are built a
+  // bounded chunk of pairs at a time. Owned by the caller.
+  template <typename Emit>
+  static matrix from_bit_rows(size_t size, Emit &&emit) {
+    using word = bit_matrix::word;
+    matrix result = Backend::new_matrix(size, size);
+    if constexpr (requires(matrix m, index v, const word *bits) {
+                    Backend::or_row(m, v, bits);
+                  }) {
+      emit([&](index v, const word *bits) {
+        Backend::or_row(result, v, bits);
+      });
+    } else {
+      constexpr size_t chunk = size_t{1} << 20;
+      std::vector<index> rows, cols;
+      auto flush = [&] {
+        matrix part = Backend::new_matrix(size, size);
+        Backend::build(part, rows.data(), cols.data(), rows.size());
+        Backend::accumulate(result, part);
+        Backend::free(part);
+        rows.clear();
+        cols.clear();
+      };
+      emit([&](index v, const word *bits) {
+        for (size_t w = 0; w < (size + 63) / 64; w++)
+          for (word x = bits[w]; x != 0; x &= x - 1) {
+            rows.push_back(v);
+            cols.push_back(w * 64 + std::countr_zero(x));
+          }
+        if (rows.size() >= chunk)
+          flush();
+      });
+      if (!rows.empty())
+        flush();
+    }
+    return result;
+  }
+
+  // whether m has the entry (from, to): a row selector and a column selector
+  // cut it out as a 1 x 1 product
+  static bool contains(matrix m, index from, index to, size_t size) {
+    index zero = 0;
+    matrix row = Backend::new_matrix(1, size);
+    matrix col = Backend::new_matrix(size, 1);
+    Backend::build(row, &zero, &from, 1);
+    Backend::build(col, &to, &zero, 1);
+    matrix selected_row = Backend::new_matrix(1, size);
+    matrix cell = Backend::new_matrix(1, 1);
+    Backend::mxm_accumulate(selected_row, row, m);
+    Backend::mxm_accumulate(cell, selected_row, col);
+    bool found = Backend::nvals(cell) != 0;
+    for (matrix handle : {row, col, selected_row, cell})
+      Backend::free(handle);
+    return found;
+  }
+
+  // target -= entries
+  static void remove(matrix &target, matrix entries) {
+    matrix rest = Backend::difference(target, entries);
+    Backend::free(target);
+    target = rest;
+  }
+
+  // target |= entries, the entries new to target are also added to fresh;
+  // returns their number
+  static size_t add_new(matrix &target, matrix entries, matrix &fresh) {
+    matrix added = Backend::difference(entries, target);
+    size_t count = Backend::nvals(added);
+    if (count != 0) {
+      Backend::accumulate(target, added);
+      Backend::accumulate(fresh, added);
+    }
+    Backend::free(added);
+    return count;
+  }
+
+  // matrices[key], created empty on first use
+  static matrix &entry(std::map<std::string, matrix> &matrices,
+                       const std::string &key, size_t size) {
+    auto [it, inserted] = matrices.try_emplace(key);
+    if (inserted)
+      it->second = Backend::new_matrix(size, size);
+    return it->second;
+  }
+
+  static void free_all(std::map<std::string, matrix> &matrices) {
+    for (auto &[label, handle] : matrices)
+      Backend::free(handle);
+    matrices.clear();
+  }
+
+  // operands are referenced, not copied: backends such as cuBool replace a
+  // handle when they accumulate into it, so earlier products of a batch may
+  // change the operands of later ones
+  struct product_target {
+    matrix *result;
+    matrix *right;
+    matrix *fresh;
+  };
+
+  // mxm_add of one left operand with several right operands, in a single
+  // pass over left when the backend has a batched kernel
+  static std::vector<size_t>
+  mxm_add_batch(matrix *left, const std::vector<product_target> &targets) {
+    if constexpr (requires { Backend::mxm_add_batch(left, targets); }) {
+      return Backend::mxm_add_batch(left, targets);
+    } else {
+      std::vector<size_t> added;
+      for (const auto &target : targets)
+        added.push_back(Backend::mxm_add(*target.result, *left, *target.right,
+                                         *target.fresh));
+      return added;
+    }
+  }
+
+  struct batch {
+    matrix *left;
+    std::vector<product_target> targets;
+  };
+
+  struct product {
+    matrix *result;
+    matrix *left;
+    matrix *right;
+    matrix *fresh;
+  };
+
+  // mxm_add_batch of every batch. Backends with a stacked kernel first take
+  // every batch of a single product, whatever its rule, in one pass. On thread-safe backends independent
+  // batches run concurrently: a batch joins the first wave in which nothing
+  // reads what it writes or writes what it touches, the batches of a wave
+  // run on the shared thread pool and waves run one after another.
+  static std::vector<std::vector<size_t>>
+  mxm_add_batches(const std::vector<batch> &batches) {
+    std::vector<std::vector<size_t>> added(batches.size());
+    std::vector<size_t> pending;
+    if constexpr (requires(const std::vector<product> &products) {
+                    Backend::mxm_add_stacked(products);
+                  }) {
+      std::vector<product> stacked;
+      std::vector<size_t> owners;
+      for (size_t b = 0; b < batches.size(); b++) {
+        if (batches[b].targets.size() != 1) {
+          pending.push_back(b);
+          continue;
+        }
+        const auto &target = batches[b].targets.front();
+        stacked.push_back(
+            {target.result, batches[b].left, target.right, target.fresh});
+        owners.push_back(b);
+      }
+      if (!stacked.empty()) {
+        auto counts = Backend::mxm_add_stacked(stacked);
+        for (size_t p = 0; p < owners.size(); p++)
+          added[owners[p]] = {counts[p]};
+      }
+    } else {
+      for (size_t b = 0; b < batches.size(); b++)
+        pending.push_back(b);
+    }
+
+    if constexpr (requires { requires Backend::thread_safe; }) {
+      if (!thread_pool::in_worker()) {
+        struct wave {
+          std::vector<size_t> members;
+          std::set<const matrix *> reads, writes;
+        };
+        std::vector<wave> waves;
+        for (size_t b : pending) {
+          std::set<const matrix *> reads{batches[b].left}, writes;
+          for (const auto &target : batches[b].targets) {
+            reads.insert(target.right);
+            writes.insert(target.result);
+            writes.insert(target.fresh);
+          }
+          auto independent = [&](const wave &w) {
+            return std::none_of(writes.begin(), writes.end(),
+                                [&](const matrix *m) {
+                                  return w.reads.contains(m) ||
+                                         w.writes.contains(m);
+                                }) &&
+                   std::none_of(reads.begin(), reads.end(),
+                                [&](const matrix *m) {
+                                  return w.writes.contains(m);
+                                });
+          };
+          auto it = std::find_if(waves.begin(), waves.end(), independent);
+          if (it == waves.end())
+            it = waves.emplace(waves.end());
+          it->members.push_back(b);
+          it->reads.insert(reads.begin(), reads.end());
+          it->writes.insert(writes.begin(), writes.end());
+        }
+
+        thread_pool &pool = thread_pool::shared();
+        for (const auto &w : waves) {
+          // a single batch keeps the row parallelism of its kernel
+          if (w.members.size() == 1) {
+            size_t b = w.members.front();
+            added[b] = mxm_add_batch(batches[b].left, batches[b].targets);
+            continue;
+          }
+          for (size_t b : w.members)
+            pool.submit([&, b] {
+              added[b] = mxm_add_batch(batches[b].left, batches[b].targets);
+            });
+          pool.wait();
+        }
+        return added;
+      }
+    }
+    for (size_t b : pending)
+      added[b] = mxm_add_batch(batches[b].left, batches[b].targets);
+    return added;
+  }
+
+  // moves the entries of derived that target does not have yet into target,
+  // they are returned as the next delta; derived is consumed
+  static std::map<std::string, matrix>
+  merge_new(label_decomposed_graph<Backend> &target,
+            std::map<std::string, matrix> &derived) {
+    std::map<std::string, matrix> delta;
+    for (auto &[label, product] : derived) {
+      matrix fresh = Backend::difference(product, target[label]);
+      if (Backend::nvals(fresh) == 0) {
+        Backend::free(fresh);
+        continue;
+      }
+      Backend::accumulate(target[label], fresh);
+      delta[label] = fresh;
+    }
+    free_all(derived);
+    return delta;
+  }
+};
@@ -0,0 +1,472 @@
+#pragma once
+#include "../thread_pool/thread_pool.hpp"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <utility>
+#include <vector>
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+// word kernels, vectorized when the target supports it
+namespace bit_kernels {
+using word = uint64_t;
+
+// dst |= src
+inline void or_words(word *dst, const word *src, size_t n) {
+  size_t i = 0;
+#if defined(__AVX512F__)
+  for (; i + 8 <= n; i += 8) {
+    __m512i a = _mm512_loadu_si512(dst + i);
+    __m512i b = _mm512_loadu_si512(src + i);
+    _mm512_storeu_si512(dst + i, _mm512_or_si512(a, b));
+  }
+#elif defined(__AVX2__)
+  for (; i + 4 <= n; i += 4) {
+    __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(dst + i));
+    __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i),
+                        _mm256_or_si256(a, b));
+  }
+#endif
+  for (; i < n; i++)
+    dst[i] |= src[i];
+}
+
+// dst &= src
+inline void and_words(word *dst, const word *src, size_t n) {
+  size_t i = 0;
+#if defined(__AVX512F__)
+  for (; i + 8 <= n; i += 8) {
+    __m512i a = _mm512_loadu_si512(dst + i);
+    __m512i b = _mm512_loadu_si512(src + i);
+    _mm512_storeu_si512(dst + i, _mm512_and_si512(a, b));
+  }
+#elif defined(__AVX2__)
+  for (; i + 4 <= n; i += 4) {
+    __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(dst + i));
+    __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i),
+                        _mm256_and_si256(a, b));
+  }
+#endif
+  for (; i < n; i++)
+    dst[i] &= src[i];
+}
+
+// dst &= ~src
+inline void andnot_words(word *dst, const word *src, size_t n) {
+  size_t i = 0;
+#if defined(__AVX512F__)
+  for (; i + 8 <= n; i += 8) {
+    __m512i a = _mm512_loadu_si512(dst + i);
+    __m512i b = _mm512_loadu_si512(src + i);
+    _mm512_storeu_si512(dst + i, _mm512_andnot_si512(b, a));
+  }
+#elif defined(__AVX2__)
+  for (; i + 4 <= n; i += 4) {
+    __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(dst + i));
+    __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i),
+                        _mm256_andnot_si256(b, a));
+  }
+#endif
+  for (; i < n; i++)
+    dst[i] &= ~src[i];
+}
+
+inline size_t popcount_words(const word *src, size_t n) {
+  size_t result = 0;
+  for (size_t i = 0; i < n; i++)
+    result += std::popcount(src[i]);
+  return result;
+}
+
+// dst bits [offset, offset + bits) |= src bits [0, bits)
+inline void or_shifted(word *dst, size_t offset, const word *src,
+                       size_t bits) {
+  size_t words = (bits + 63) / 64, shift = offset % 64;
+  word *out = dst + offset / 64;
+  for (size_t w = 0; w < words; w++) {
+    word x = src[w];
+    if (w == words - 1 && bits % 64 != 0)
+      x &= (word{1} << (bits % 64)) - 1;
+    out[w] |= x << shift;
+    if (shift != 0 && (x >> (64 - shift)) != 0)
+      out[w + 1] |= x >> (64 - shift);
+  }
+}
+
+// dst bits [0, bits) = src bits [offset, offset + bits)
+inline void copy_shifted(word *dst, const word *src, size_t offset,
+                         size_t bits) {
+  size_t words = (bits + 63) / 64, shift = offset % 64;
+  const word *in = src + offset / 64;
+  for (size_t w = 0; w < words; w++) {
+    word x = in[w] >> shift;
+    if (shift != 0 && w * 64 + 64 - shift < bits)
+      x |= in[w + 1] << (64 - shift);
+    if (w == words - 1 && bits % 64 != 0)
+      x &= (word{1} << (bits % 64)) - 1;
+    dst[w] = x;
+  }
+}
+
+// dst |= src & mask, returns whether dst covers mask afterwards (dst is
+// expected to be a subset of mask)
+inline bool or_masked_words(word *dst, const word *src, const word *mask,
+                            size_t n) {
+  size_t i = 0;
+  bool complete = true;
+#if defined(__AVX512F__)
+  for (; i + 8 <= n; i += 8) {
+    __m512i m = _mm512_loadu_si512(mask + i);
+    __m512i r = _mm512_or_si512(
+        _mm512_loadu_si512(dst + i),
+        _mm512_and_si512(_mm512_loadu_si512(src + i), m));
+    _mm512_storeu_si512(dst + i, r);
+    complete &= _mm512_cmpneq_epi64_mask(r, m) == 0;
+  }
+#elif defined(__AVX2__)
+  for (; i + 4 <= n; i += 4) {
+    __m256i m = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(mask + i));
+    __m256i r = _mm256_or_si256(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(dst + i)),
+        _mm256_and_si256(
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i)), m));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), r);
+    complete &= _mm256_movemask_epi8(_mm256_cmpeq_epi64(r, m)) == -1;
+  }
+#endif
+  for (; i < n; i++) {
+    dst[i] |= src[i] & mask[i];
+    complete &= dst[i] == mask[i];
+  }
+  return complete;
+}
+
+// calls f(begin, end) on disjoint row ranges through the shared thread_pool,
+// on the calling thread only inside a worker. A few blocks per participant
+// leave the pool something to steal when rows differ in cost.
+template <typename F> void parallel_rows(size_t rows, F &&f) {
+  constexpr size_t min_rows_per_block = 64;
+  thread_pool &pool = thread_pool::shared();
+  size_t blocks =
+      std::min(rows / min_rows_per_block, 4 * (pool.size() + 1));
+  if (blocks <= 1 || thread_pool::in_worker()) {
+    f(size_t{0}, rows);
+    return;
+  }
+
+  pool.parallel_for(blocks, [&](size_t block) {
+    f(rows * block / blocks, rows * (block + 1) / blocks);
+  });
+}
+} // namespace bit_kernels
+
+// dense boolean matrix, rows are packed into 64-bit words
+class bit_matrix {
+public:
+  using word = bit_kernels::word;
+  using index = uint32_t;
+  static constexpr size_t word_bits = 64;
+
+private:
+  size_t rows_{};
+  size_t cols_{};
+  size_t words_per_row_{};
+  std::vector<word> data_;
+
+public:
+  bit_matrix() {}
+
+  bit_matrix(size_t rows, size_t cols)
+      : rows_(rows), cols_(cols),
+        words_per_row_((cols + word_bits - 1) / word_bits),
+        data_(rows * words_per_row_) {}
+
+  size_t rows() const { return rows_; }
+  size_t cols() const { return cols_; }
+  size_t words_per_row() const { return words_per_row_; }
+
+  word *row(size_t i) { return data_.data() + i * words_per_row_; }
+  const word *row(size_t i) const {
+    return data_.data() + i * words_per_row_;
+  }
+
+  bool get(size_t i, size_t j) const {
+    return (row(i)[j / word_bits] >> (j % word_bits)) & 1;
+  }
+
+  void set(size_t i, size_t j) {
+    row(i)[j / word_bits] |= word{1} << (j % word_bits);
+  }
+
+  void clear() { std::fill(data_.begin(), data_.end(), 0); }
+
+  size_t nvals() const {
+    return bit_kernels::popcount_words(data_.data(), data_.size());
+  }
+
+  bool empty() const {
+    return std::all_of(data_.begin(), data_.end(),
+                       [](word w) { return w == 0; });
+  }
+
+  void build(const index *rows, const index *cols, size_t nvals) {
+    clear();
+    for (size_t i = 0; i < nvals; i++)
+      set(rows[i], cols[i]);
+  }
+
+  // row-major order
+  std::vector<std::pair<index, index>> extract_pairs() const {
+    std::vector<std::pair<index, index>> result;
+    for (size_t i = 0; i < rows_; i++) {
+      const word *r = row(i);
+      for (size_t w = 0; w < words_per_row_; w++)
+        for (word bits = r[w]; bits != 0; bits &= bits - 1)
+          result.emplace_back(i, w * word_bits + std::countr_zero(bits));
+    }
+    return result;
+  }
+
+  bit_matrix &operator|=(const bit_matrix &other) {
+    bit_kernels::or_words(data_.data(), other.data_.data(), data_.size());
+    return *this;
+  }
+
+  bit_matrix &operator&=(const bit_matrix &other) {
+    bit_kernels::and_words(data_.data(), other.data_.data(), data_.size());
+    return *this;
+  }
+
+  // removes every entry of other
+  bit_matrix &subtract(const bit_matrix &other) {
+    bit_kernels::andnot_words(data_.data(), other.data_.data(), data_.size());
+    return *this;
+  }
+
+  // sub-matrix of the given size whose top left corner is (row, col)
+  bit_matrix block(size_t row, size_t col, size_t rows, size_t cols) const {
+    bit_matrix result(rows, cols);
+    for (size_t i = 0; i < rows; i++)
+      bit_kernels::copy_shifted(result.row(i), this->row(row + i), col, cols);
+    return result;
+  }
+
+  static bit_matrix kronecker(const bit_matrix &left, const bit_matrix &right) {
+    bit_matrix result(left.rows_ * right.rows_, left.cols_ * right.cols_);
+    for (auto [i, j] : left.extract_pairs())
+      for (size_t k = 0; k < right.rows_; k++)
+        bit_kernels::or_shifted(result.row(i * right.rows_ + k),
+                                j * right.cols_, right.row(k), right.cols_);
+    return result;
+  }
+
+  // bits of row i that are not set yet, returns false if there are none
+  bool missing(size_t i, word *out) const {
+    const word *r = row(i);
+    for (size_t w = 0; w < words_per_row_; w++)
+      out[w] = ~r[w];
+    if (cols_ % word_bits != 0)
+      out[words_per_row_ - 1] &= (word{1} << (cols_ % word_bits)) - 1;
+    return std::any_of(out, out + words_per_row_,
+                       [](word w) { return w != 0; });
+  }
+
+  // result |= left x right in one pass, the bits it adds are also set in
+  // fresh and counted. Operands may alias result, they are read from a
+  // snapshot then.
+  static size_t mxm_add(bit_matrix &result, const bit_matrix &left,
+                        const bit_matrix &right, bit_matrix &fresh) {
+    return mxm_add_batch(left, {{&result, &right, &fresh}})[0];
+  }
+
+  struct product_target {
+    bit_matrix *result;
+    const bit_matrix *right;
+    bit_matrix *fresh;
+  };
+
+  // mxm_add of one left operand with several right operands: every row of
+  // left is read once and its bits select rows of all the right operands.
+  // Products are masked with the complement of the result row, so known
+  // entries are never produced: full result rows are skipped and a row stops
+  // selecting right rows once everything it misses has been found.
+  // Returns the number of new entries per target.
+  static std::vector<size_t>
+  mxm_add_batch(const bit_matrix &left, std::vector<product_target> targets) {
+    // operands that are also written are read from snapshots
+    std::deque<bit_matrix> snapshots;
+    std::map<const bit_matrix *, const bit_matrix *> readable;
+    for (const auto &target : targets)
+      readable[target.result] = nullptr;
+    auto snapshot = [&](const bit_matrix *m) {
+      auto it = readable.find(m);
+      if (it == readable.end())
+        return m;
+      if (it->second == nullptr)
+        it->second = &snapshots.emplace_back(*m);
+      return it->second;
+    };
+    const bit_matrix &shared = *snapshot(&left);
+    for (auto &target : targets)
+      target.right = snapshot(target.right);
+
+    std::vector<size_t> added(targets.size(), 0);
+    std::mutex added_mutex;
+    bit_kernels::parallel_rows(shared.rows_, [&](size_t begin, size_t end) {
+      size_t words = 0;
+      for (const auto &target : targets)
+        words = std::max(words, target.right->words_per_row_);
+      std::vector<word> mask(words), product(words);
+      std::vector<size_t> counts(targets.size(), 0);
+      std::vector<size_t> selected;
+      for (size_t i = begin; i < end; i++) {
+        selected.clear();
+        const word *src = shared.row(i);
+        for (size_t w = 0; w < shared.words_per_row_; w++)
+          for (word bits = src[w]; bits != 0; bits &= bits - 1)
+            selected.push_back(w * word_bits + std::countr_zero(bits));
+        if (selected.empty())
+          continue;
+
+        for (size_t t = 0; t < targets.size(); t++) {
+          const bit_matrix &right = *targets[t].right;
+          if (!targets[t].result->missing(i, mask.data()))
+            continue;
+          std::fill(product.begin(), product.end(), 0);
+          for (size_t k : selected)
+            if (bit_kernels::or_masked_words(product.data(), right.row(k),
+                                             mask.data(),
+                                             right.words_per_row_))
+              break;
+
+          // product only has bits the result row misses
+          bit_kernels::or_words(targets[t].result->row(i), product.data(),
+                                right.words_per_row_);
+          bit_kernels::or_words(targets[t].fresh->row(i), product.data(),
+                                right.words_per_row_);
+          counts[t] +=
+              bit_kernels::popcount_words(product.data(), right.words_per_row_);
+        }
+      }
+      std::lock_guard lock(added_mutex);
+      for (size_t t = 0; t < targets.size(); t++)
+        added[t] += counts[t];
+    });
+    return added;
+  }
+
+  struct product {
+    bit_matrix *result;
+    const bit_matrix *left;
+    const bit_matrix *right;
+    bit_matrix *fresh;
+  };
+
+  // mxm_add of many products with operands of their own in one pass. The
+  // products are stacked by result, each (result, row) pair is one task of a
+  // work-stealing loop that runs every product into that row under one mask:
+  // products into a shared result stop once the row is complete. Products of one
+  // result share its fresh matrix. Operands that are also written are read
+  // from snapshots. Returns the number of new entries per product.
+  static std::vector<size_t> mxm_add_stacked(std::vector<product> products) {
+    std::deque<bit_matrix> snapshots;
+    std::map<const bit_matrix *, const bit_matrix *> readable;
+    for (const auto &p : products)
+      readable[p.result] = nullptr;
+    auto snapshot = [&](const bit_matrix *m) {
+      auto it = readable.find(m);
+      if (it == readable.end())
+        return m;
+      if (it->second == nullptr)
+        it->second = &snapshots.emplace_back(*m);
+      return it->second;
+    };
+    for (auto &p : products) {
+      p.left = snapshot(p.left);
+      p.right = snapshot(p.right);
+    }
+
+    // task t is row t - first[r] of results[r]
+    std::map<const bit_matrix *, size_t> result_of;
+    std::vector<std::vector<size_t>> by_result;
+    std::vector<size_t> first{0};
+    for (size_t p = 0; p < products.size(); p++) {
+      auto [it, inserted] =
+          result_of.try_emplace(products[p].result, by_result.size());
+      if (inserted) {
+        by_result.emplace_back();
+        first.push_back(first.back() + products[p].result->rows_);
+      }
+      by_result[it->second].push_back(p);
+    }
+
+    std::vector<std::atomic<size_t>> added(products.size());
+    thread_pool::shared().parallel_for(first.back(), [&](size_t task) {
+      size_t r = std::upper_bound(first.begin(), first.end(), task) -
+                 first.begin() - 1;
+      size_t i = task - first[r];
+      bit_matrix &result = *products[by_result[r].front()].result;
+      bit_matrix &fresh = *products[by_result[r].front()].fresh;
+      size_t words = result.words_per_row_;
+      thread_local std::vector<word> mask, row;
+      mask.resize(words);
+      row.resize(words);
+      if (!result.missing(i, mask.data()))
+        return;
+
+      for (size_t p : by_result[r]) {
+        const bit_matrix &left = *products[p].left;
+        const bit_matrix &right = *products[p].right;
+        std::fill(row.begin(), row.end(), 0);
+        bool complete = false;
+        const word *src = left.row(i);
+        for (size_t w = 0; w < left.words_per_row_ && !complete; w++)
+          for (word bits = src[w]; bits != 0 && !complete; bits &= bits - 1)
+            complete = bit_kernels::or_masked_words(
+                row.data(),
+                right.row(w * word_bits + std::countr_zero(bits)),
+                mask.data(), words);
+
+        size_t count = bit_kernels::popcount_words(row.data(), words);
+        if (count == 0)
+          continue;
+        bit_kernels::or_words(result.row(i), row.data(), words);
+        bit_kernels::or_words(fresh.row(i), row.data(), words);
+        added[p] += count;
+        if (complete)
+          break;
+        bit_kernels::andnot_words(mask.data(), row.data(), words);
+      }
+    });
+    return std::vector<size_t>(added.begin(), added.end());
+  }
+
+  // result (|)= left x right; row i of the product is the union of the rows
+  // of right selected by the bits of row i of left
+  static void mxm(bit_matrix &result, const bit_matrix &left,
+                  const bit_matrix &right, bool accumulate = false) {
+    if (!accumulate)
+      result.clear();
+    bit_kernels::parallel_rows(left.rows_, [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; i++) {
+        word *dst = result.row(i);
+        const word *src = left.row(i);
+        for (size_t w = 0; w < left.words_per_row_; w++)
+          for (word bits = src[w]; bits != 0; bits &= bits - 1) {
+            size_t k = w * word_bits + std::countr_zero(bits);
+            bit_kernels::or_words(dst, right.row(k), right.words_per_row_);
+          }
+      }
+    });
+  }
+};
@@ -4,6 +4,8 @@
 #include <fstream>
 #include <functional>
 #include <iostream>
+#include <map>
+#include <optional>
 #include <ranges>
 #include <set>
 #include <stdexcept>
@@ -34,6 +36,13 @@ public:
 
     operator std::string() const { return label_; }
 
+    // store_i with index 3 is store_3, symbols without _i stay as they are
+    symbol with_index(const std::string &index) const {
+      if (!is_indexed_)
+        return *this;
+      return symbol(label_.substr(0, label_.size() - 1) + index);
+    }
+
     int hash() { return std::hash<std::string>{}(label_); }
   };
 
@@ -161,5 +170,198 @@ public:
     return result_set;
   }
 
+  // indices the indexed terminals take among the labels: store_3 gives 3
+  // for a terminal store_i
+  std::set<std::string> indices_in(const std::vector<std::string> &labels) {
+    std::set<symbol> nonterms = non_terminals();
+    std::set<std::string> prefixes;
+    for (const symbol &s : symbols())
+      if (s.is_indexed_ && !nonterms.contains(s))
+        prefixes.insert(s.label_.substr(0, s.label_.size() - 1));
+    std::set<std::string> result;
+    for (const auto &label : labels)
+      for (const auto &prefix : prefixes)
+        if (label.size() > prefix.size() && label.starts_with(prefix))
+          result.insert(label.substr(prefix.size()));
+    return result;
+  }
+
+  // POCR grammars write one rule for all fields: every _i symbol of a rule
+  // stands for the same index. Such rules are repeated once per given index,
+  // the others are kept.
+  cnf_grammar instantiate(const std::set<std::string> &indices) const {
+    cnf_grammar result;
+    result.start_nonterm_ = start_nonterm_;
+    for (const symbol &lhs : epsilon_rules_)
+      if (!lhs.is_indexed_)
+        result.epsilon_rules_.push_back(lhs);
+      else
+        for (const auto &index : indices)
+          result.epsilon_rules_.push_back(lhs.with_index(index));
+    for (const auto &[lhs, rhs] : simple_rules_)
+      if (!lhs.is_indexed_ && !rhs.is_indexed_)
+        result.simple_rules_.emplace_back(lhs, rhs);
+      else
+        for (const auto &index : indices)
+          result.simple_rules_.emplace_back(lhs.with_index(index),
+                                            rhs.with_index(index));
+    for (const auto &[lhs, rhs1, rhs2] : complex_rules_)
+      if (!lhs.is_indexed_ && !rhs1.is_indexed_ && !rhs2.is_indexed_)
+        result.complex_rules_.emplace_back(lhs, rhs1, rhs2);
+      else
+        for (const auto &index : indices)
+          result.complex_rules_.emplace_back(lhs.with_index(index),
+                                             rhs1.with_index(index),
+                                             rhs2.with_index(index));
+    return result;
+  }
+
+  // strongly connected components of the nonterminal dependency graph
+  // (lhs -> every rhs symbol), dependencies come before their dependents
+  std::vector<std::set<symbol>> strongly_connected_components() {
+    std::set<symbol> nonterms = non_terminals();
+    std::map<symbol, std::set<symbol>> depends_on;
+    for (const auto &[lhs, rhs] : simple_rules_)
+      if (nonterms.contains(rhs))
+        depends_on[lhs].insert(rhs);
+    for (const auto &[lhs, rhs1, rhs2] : complex_rules_) {
+      if (nonterms.contains(rhs1))
+        depends_on[lhs].insert(rhs1);
+      if (nonterms.contains(rhs2))
+        depends_on[lhs].insert(rhs2);
+    }
+
+    // Tarjan emits a component only after everything it depends on
+    std::vector<std::set<symbol>> result;
+    std::map<symbol, size_t> index, low;
+    std::vector<symbol> stack;
+    std::set<symbol> on_stack;
+    std::function<void(const symbol &)> visit = [&](const symbol &v) {
+      size_t order = index.size();
+      index[v] = low[v] = order;
+      stack.push_back(v);
+      on_stack.insert(v);
+      for (const symbol &to : depends_on[v]) {
+        if (!index.contains(to)) {
+          visit(to);
+          low[v] = std::min(low[v], low[to]);
+        } else if (on_stack.contains(to)) {
+          low[v] = std::min(low[v], index[to]);
+        }
+      }
+      if (low[v] != index[v])
+        return;
+      std::set<symbol> component;
+      symbol top;
+      do {
+        top = stack.back();
+        stack.pop_back();
+        on_stack.erase(top);
+        component.insert(top);
+      } while (top.label_ != v.label_);
+      result.push_back(component);
+    };
+    for (const symbol &v : nonterms)
+      if (!index.contains(v))
+        visit(v);
+
+    return result;
+  }
+
+  // nonterminals A with A -> A A whose other rules are A -> A, A -> eps and
+  // A -> x for symbols x that do not depend on A: A derives exactly the
+  // nonempty paths over the x edges (and the empty one if nullable), its
+  // matrix is the transitive closure of theirs
+  std::set<symbol> closure_nonterminals() {
+    std::set<symbol> result;
+    for (const auto &[lhs, rhs1, rhs2] : complex_rules_)
+      if (rhs1.label_ == lhs.label_ && rhs2.label_ == lhs.label_)
+        result.insert(lhs);
+    for (const auto &[lhs, rhs1, rhs2] : complex_rules_)
+      if (rhs1.label_ != lhs.label_ || rhs2.label_ != lhs.label_)
+        result.erase(lhs);
+    for (const auto &component : strongly_connected_components())
+      if (component.size() > 1)
+        for (const symbol &s : component)
+          result.erase(s);
+    return result;
+  }
+
+  // parenthesis pairs of a grammar for Dyck words, see dyck()
+  struct dyck_shape {
+    std::vector<std::pair<symbol, symbol>> parens;
+    // X -> S c or X -> o S, the only rule of every other nonterminal
+    std::vector<std::tuple<symbol, symbol, symbol>> helpers;
+  };
+
+  // Recognises S -> S S | o X | o c | eps with X -> S c (or S -> X c with
+  // X -> o S) for distinct terminal pairs (o, c), S the start nonterminal:
+  // S derives the nonempty Dyck words over the pairs, every one when
+  // nullable. S -> o c may only be left out when S is nullable.
+  std::optional<dyck_shape> dyck() {
+    std::set<symbol> nonterms = non_terminals();
+    symbol start = start_nonterm_;
+    auto is = [](const symbol &a, const symbol &b) {
+      return a.label_ == b.label_;
+    };
+    if (!simple_rules_.empty())
+      return std::nullopt;
+    for (const symbol &lhs : epsilon_rules_)
+      if (!is(lhs, start))
+        return std::nullopt;
+    bool nullable = !epsilon_rules_.empty();
+
+    // X -> S c closes, X -> o S opens
+    std::map<std::string, std::pair<symbol, bool>> helper;
+    dyck_shape shape;
+    for (const auto &rule : complex_rules_) {
+      const auto &[lhs, rhs1, rhs2] = rule;
+      if (is(lhs, start))
+        continue;
+      if (helper.contains(lhs))
+        return std::nullopt;
+      if (is(rhs1, start) && !nonterms.contains(rhs2))
+        helper.try_emplace(lhs, rhs2, true);
+      else if (is(rhs2, start) && !nonterms.contains(rhs1))
+        helper.try_emplace(lhs, rhs1, false);
+      else
+        return std::nullopt;
+      shape.helpers.push_back(rule);
+    }
+
+    bool concatenation = false;
+    std::map<std::pair<std::string, std::string>, std::pair<bool, bool>>
+        wrapped_direct;
+    for (const auto &[lhs, rhs1, rhs2] : complex_rules_) {
+      if (!is(lhs, start))
+        continue;
+      if (is(rhs1, start) && is(rhs2, start)) {
+        concatenation = true;
+      } else if (!nonterms.contains(rhs1) && !nonterms.contains(rhs2)) {
+        wrapped_direct[{rhs1, rhs2}].second = true;
+      } else if (!nonterms.contains(rhs1) && helper.contains(rhs2) &&
+                 helper.at(rhs2).second) {
+        wrapped_direct[{rhs1, helper.at(rhs2).first}].first = true;
+      } else if (helper.contains(rhs1) && !helper.at(rhs1).second &&
+                 !nonterms.contains(rhs2)) {
+        wrapped_direct[{helper.at(rhs1).first, rhs2}].first = true;
+      } else {
+        return std::nullopt;
+      }
+    }
+    if (!concatenation || wrapped_direct.empty())
+      return std::nullopt;
+
+    std::set<std::string> used;
+    for (const auto &[pair, forms] : wrapped_direct) {
+      const auto &[open, close] = pair;
+      if (!forms.first || (!nullable && !forms.second) ||
+          !used.insert(open).second || !used.insert(close).second)
+        return std::nullopt;
+      shape.parens.emplace_back(open, close);
+    }
+    return shape;
+  }
+
   ~cnf_grammar() {}
 };
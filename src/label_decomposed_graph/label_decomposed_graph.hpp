@@ -1,5 +1,5 @@
 #pragma once
-#include <cubool.h>
+#include "../matrix_backend/matrix_backend.hpp"
 #include <fstream>
 #include <iostream>
 #include <map>
@@ -9,9 +9,14 @@
 #include <utility>
 #include <vector>
 
+template <matrix_backend Backend = default_backend>
 class label_decomposed_graph {
+public:
+  using matrix = typename Backend::matrix;
+  using index = typename Backend::index;
+
 private:
-  std::map<std::string, cuBool_Matrix> matrices{};
+  std::map<std::string, matrix> matrices{};
 
 public:
   using PairOfValues = std::pair<std::vector<int>, std::vector<int>>;
@@ -50,12 +55,12 @@ public:
     ++matrix_size;
 
     for (auto &[label, value] : result_matrix) {
-      cuBool_Matrix *matrix = &matrices[label];
-      cuBool_Matrix_New(matrix, matrix_size, matrix_size);
+      matrix &m = matrices[label];
+      m = Backend::new_matrix(matrix_size, matrix_size);
       size_t number_of_values = value.first.size();
 
-      std::vector<cuBool_Index> rows(number_of_values, 0);
-      std::vector<cuBool_Index> cols(number_of_values, 0);
+      std::vector<index> rows(number_of_values, 0);
+      std::vector<index> cols(number_of_values, 0);
 
       size_t i = 0;
       for (auto x : value.first) {
@@ -65,44 +70,60 @@ public:
       for (auto x : value.second) {
         cols[i++] = x;
       }
-      cuBool_Matrix_Build(*matrix, rows.data(), cols.data(), number_of_values,
-                          CUBOOL_HINT_NO);
+      Backend::build(m, rows.data(), cols.data(), number_of_values);
     }
     file.close();
   }
 
-  label_decomposed_graph(const label_decomposed_graph &other) {
+  label_decomposed_graph(const label_decomposed_graph &other)
+      : matrix_size(other.matrix_size) {
     for (const auto& [key, matrix] : other.matrices) {
-      cuBool_Matrix_Duplicate(matrix, &matrices[key]);
+      matrices[key] = Backend::duplicate(matrix);
     }
   }
 
-  cuBool_Matrix &operator[](const std::string &key) {
+  label_decomposed_graph &operator=(const label_decomposed_graph &other) {
+    label_decomposed_graph copy(other);
+    std::swap(matrices, copy.matrices);
+    std::swap(matrix_size, copy.matrix_size);
+    return *this;
+  }
+
+  matrix &operator[](const std::string &key) {
     if (matrices.find(key) == matrices.end()) {
-      cuBool_Matrix *matrix = &matrices[key];
-      cuBool_Matrix_New(matrix, matrix_size, matrix_size);
       // std::cout << "create new matrix in [" << key << "]" << std::endl;
-      cuBool_Matrix_Build(*matrix, nullptr, nullptr, 0, CUBOOL_HINT_NO);
+      matrices[key] = Backend::new_matrix(matrix_size, matrix_size);
     }
     // std::cout << "find matrix in [" << key << "]" << std::endl;
     return matrices[key];
   }
 
-  cuBool_Matrix &get_item(const std::string &key) {
+  matrix &get_item(const std::string &key) {
     if (matrices.find(key) == matrices.end())
       ;
     return matrices[key];
   }
 
-  void set_item(const std::string &key, const cuBool_Matrix &matr) {
+  void set_item(const std::string &key, const matrix &matr) {
     matrices.emplace(key, matr);
   }
 
+  bool contains(const std::string &key) const {
+    return matrices.contains(key);
+  }
+
   size_t size() { return matrices.size(); }
 
+  std::vector<std::string> labels() const {
+    std::vector<std::string> result;
+    for (const auto &[label, matr] : matrices)
+      result.push_back(label);
+    return result;
+  }
+
   ~label_decomposed_graph() {
     for (auto &matr : matrices) {
-      cuBool_Matrix_Free(matr.second);
+      Backend::free(matr.second);
     }
   }
 };
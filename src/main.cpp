@@ -1,6 +1,9 @@
 #include "base_algo/base_matrix_algo.hpp"
+#include "tensor_algo/tensor_algo.hpp"
+#include <algorithm>
 #include <fstream>
 #include <iostream>
+#include <type_traits>
 #include <vector>
 
 template <typename T, typename... Args> void error(T first, Args... args) {
@@ -9,51 +12,167 @@ template <typename T, typename... Args> void error(T first, Args... args) {
     error(args...);
 }
 
+enum class Engine { matrix, tensor };
+
 struct Config {
   std::string test_name;
   std::string graph;
   std::string grammar;
   std::string expected;
+  // multiple-source query when not empty
+  std::vector<int> sources{};
+  Engine engine = Engine::matrix;
+  // every pair is answered by its own point query
+  bool queries = false;
+  // edges inserted into the solved graph before the result is taken
+  std::string added{};
+  // edges removed from the solved graph before the result is taken
+  std::string removed{};
+  // shortest derivation length of every expected pair, checked with the
+  // tropical backend
+  std::string lengths{};
+  // (nonterminal, expected file) pairs checked from one solve_all() and
+  // one solve_all(nonterminals) call
+  std::vector<std::pair<std::string, std::string>> nonterminals{};
 };
 
-bool run_algo(const Config &config, const std::string &path_to_testdir) {
-  cuBool_Initialize(CUBOOL_HINT_NO);
-
-  matrix_base_algo algo(path_to_testdir + config.grammar,
-                        path_to_testdir + config.graph);
-  cuBool_Matrix result = algo.solve();
-  size_t n = algo.matrix_size * algo.matrix_size;
-  cuBool_Index tc_rows[n], tc_cols[n];
-  cuBool_Index nvals;
-  cuBool_Matrix_Nvals(result, &nvals);
-  cuBool_Matrix_ExtractPairs(result, tc_rows, tc_cols, &nvals);
-
-  // check resutls
-  std::ifstream file(path_to_testdir + config.expected);
+// whether the sorted pairs are exactly those listed in the file at path
+template <typename Index>
+bool matches(const std::vector<std::pair<Index, Index>> &pairs,
+             const std::string &path) {
+  std::ifstream file(path);
   if (!file) {
-    std::cout << "Can't open file : " << path_to_testdir + config.expected
-              << std::endl;
+    std::cout << "Can't open file : " << path << std::endl;
     return false;
   }
   std::vector<std::pair<int, int>> expected;
   {
     int row, col;
-    while (file) {
-      file >> row >> col;
+    while (file >> row >> col)
       expected.emplace_back(row, col);
-    }
   }
 
-  for (int i = 0; i < nvals; i++) {
-    if (expected[i].first != tc_rows[i] || expected[i].second != tc_cols[i])
+  if (pairs.size() != expected.size())
+    return false;
+  for (size_t i = 0; i < pairs.size(); i++) {
+    if (expected[i].first != pairs[i].first ||
+        expected[i].second != pairs[i].second)
       return false;
   }
-  cuBool_Matrix_Free(result);
-
-  cuBool_Finalize();
   return true;
 }
 
+template <matrix_backend Backend>
+bool run_algo(const Config &config, const std::string &path_to_testdir) {
+  Backend::initialize();
+  // finalized on every return, after the matrices of the run are freed
+  struct finalizer {
+    ~finalizer() { Backend::finalize(); }
+  } finalize;
+  std::vector<std::pair<typename Backend::index, typename Backend::index>>
+      pairs;
+  if (config.engine == Engine::tensor) {
+    tensor_algo<Backend> algo(path_to_testdir + config.grammar,
+                              path_to_testdir + config.graph);
+    auto result = algo.solve();
+    pairs = Backend::extract_pairs(result);
+    Backend::free(result);
+  } else if (config.queries) {
+    label_decomposed_graph<Backend> graph(path_to_testdir + config.graph);
+    cnf_grammar grammar(path_to_testdir + config.grammar);
+    for (size_t from = 0; from < graph.matrix_size; from++)
+      for (size_t to = 0; to < graph.matrix_size; to++)
+        if (matrix_base_algo<Backend>(grammar, graph).query(from, to))
+          pairs.emplace_back(from, to);
+  } else {
+    matrix_base_algo<Backend> algo(path_to_testdir + config.grammar,
+                                   path_to_testdir + config.graph);
+    std::vector<typename Backend::index> sources(config.sources.begin(),
+                                                 config.sources.end());
+    auto read_edges = [&](const std::string &path) {
+      std::ifstream file(path_to_testdir + path);
+      std::vector<typename matrix_base_algo<Backend>::edge> edges;
+      typename Backend::index from, to;
+      std::string label;
+      while (file >> from >> label >> to)
+        edges.emplace_back(from, label, to);
+      return edges;
+    };
+    if (!config.added.empty()) {
+      Backend::free(algo.solve());
+      algo.add_edges(read_edges(config.added));
+    }
+    if (!config.removed.empty()) {
+      Backend::free(algo.solve());
+      algo.remove_edges(read_edges(config.removed));
+    }
+    auto result = sources.empty() ? algo.solve() : algo.solve(sources);
+    pairs = Backend::extract_pairs(result);
+    Backend::free(result);
+
+    if (!config.nonterminals.empty()) {
+      std::vector<std::string> names;
+      for (const auto &[name, expected] : config.nonterminals)
+        names.push_back(name);
+      auto some = algo.solve_all(names);
+      auto every = algo.solve_all();
+      bool found = true;
+      for (const auto &[name, expected] : config.nonterminals)
+        found = found && every.contains(name) &&
+                matches(Backend::extract_pairs(some[name]),
+                        path_to_testdir + expected) &&
+                matches(Backend::extract_pairs(every[name]),
+                        path_to_testdir + expected);
+      for (auto *solved : {&some, &every})
+        for (auto &[name, matrix] : *solved)
+          Backend::free(matrix);
+      if (!found)
+        return false;
+    }
+
+    if constexpr (std::is_same_v<Backend, tropical_backend>) {
+      if (!config.lengths.empty()) {
+        std::ifstream file(path_to_testdir + config.lengths);
+        typename Backend::index from, to;
+        size_t length, checked = 0;
+        for (; file >> from >> to >> length; checked++)
+          if (algo.path_length(from, to) != length)
+            return false;
+        if (checked != pairs.size())
+          return false;
+      }
+    }
+
+    // every witness has to be a path between the ends of its pair, pairs
+    // outside the result have none
+    if constexpr (witness_backend<Backend>) {
+      if (sources.empty())
+        for (typename Backend::index from = 0; from < algo.matrix_size; from++)
+          for (typename Backend::index to = 0; to < algo.matrix_size; to++)
+            if (!std::binary_search(pairs.begin(), pairs.end(),
+                                    std::pair(from, to)) &&
+                algo.witness(from, to))
+              return false;
+      for (auto [from, to] : sources.empty() ? pairs : decltype(pairs){}) {
+        auto path = algo.witness(from, to);
+        if (!path)
+          return false;
+        auto at = from;
+        for (const auto &[v, label, u] : *path) {
+          if (v != at)
+            return false;
+          at = u;
+        }
+        if (at != to || path->size() != algo.path_length(from, to))
+          return false;
+      }
+    }
+  }
+
+  // check resutls
+  return matches(pairs, path_to_testdir + config.expected);
+}
+
 bool test(const std::string &path_to_testdir) {
   std::vector<Config> configs{
       {
@@ -61,6 +180,49 @@ bool test(const std::string &path_to_testdir) {
           .graph = "an_bn/graph.txt",
           .grammar = "an_bn/grammar.cnf",
           .expected = "an_bn/expected.txt",
+          .lengths = "an_bn/expected_lengths.txt",
+      },
+      {
+          .test_name = "an_bn_all",
+          .graph = "an_bn/graph.txt",
+          .grammar = "an_bn/grammar.cnf",
+          .expected = "an_bn/expected.txt",
+          .nonterminals = {{"S", "an_bn/expected.txt"},
+                           {"Sb", "an_bn/expected_sb.txt"}},
+      },
+      {
+          .test_name = "an_bn_sources",
+          .graph = "an_bn/graph.txt",
+          .grammar = "an_bn/grammar.cnf",
+          .expected = "an_bn/expected_sources.txt",
+          .sources = {0, 2},
+      },
+      {
+          .test_name = "an_bn_queries",
+          .graph = "an_bn/graph.txt",
+          .grammar = "an_bn/grammar.cnf",
+          .expected = "an_bn/expected.txt",
+          .queries = true,
+      },
+      {
+          .test_name = "an_bn_added",
+          .graph = "an_bn/graph_base.txt",
+          .grammar = "an_bn/grammar.cnf",
+          .expected = "an_bn/expected.txt",
+          .added = "an_bn/graph_added.txt",
+      },
+      {
+          .test_name = "an_bn_removed",
+          .graph = "an_bn/graph_extra.txt",
+          .grammar = "an_bn/grammar.cnf",
+          .expected = "an_bn/expected.txt",
+          .removed = "an_bn/graph_extra_removed.txt",
+      },
+      {
+          .test_name = "an_bn_unit",
+          .graph = "an_bn/graph.txt",
+          .grammar = "an_bn/grammar_unit.cnf",
+          .expected = "an_bn/expected.txt",
       },
       {
           .test_name = "transitive_loop",
@@ -68,11 +230,87 @@ bool test(const std::string &path_to_testdir) {
           .grammar = "transitive_loop/grammar.cnf",
           .expected = "transitive_loop/expected.txt",
       },
+      {
+          .test_name = "dyck",
+          .graph = "dyck/graph.txt",
+          .grammar = "dyck/grammar.cnf",
+          .expected = "dyck/expected.txt",
+      },
+      {
+          .test_name = "fields",
+          .graph = "fields/graph.txt",
+          .grammar = "fields/grammar.cnf",
+          .expected = "fields/expected.txt",
+      },
+      {
+          .test_name = "fields_added",
+          .graph = "fields/graph_base.txt",
+          .grammar = "fields/grammar.cnf",
+          .expected = "fields/expected.txt",
+          .added = "fields/graph_added.txt",
+      },
+      {
+          .test_name = "alias",
+          .graph = "alias/graph.txt",
+          .grammar = "alias/grammar.cnf",
+          .expected = "alias/expected.txt",
+      },
+      {
+          .test_name = "alias_added",
+          .graph = "alias/graph_base.txt",
+          .grammar = "alias/grammar.cnf",
+          .expected = "alias/expected.txt",
+          .added = "alias/graph_added.txt",
+      },
+      {
+          .test_name = "an_bn_tensor",
+          .graph = "an_bn/graph.txt",
+          .grammar = "an_bn/grammar.cfg",
+          .expected = "an_bn/expected.txt",
+          .engine = Engine::tensor,
+      },
+      {
+          .test_name = "transitive_loop_tensor",
+          .graph = "transitive_loop/graph.txt",
+          .grammar = "transitive_loop/grammar.cnf",
+          .expected = "transitive_loop/expected.txt",
+          .engine = Engine::tensor,
+      },
   };
 
   for (const auto &config : configs) {
-    if (!run_algo(config, path_to_testdir)) {
-      std::cout << "faild test : " << config.test_name << std::endl;
+#ifndef CFRA_CPU_BACKEND
+    if (!run_algo<cubool_backend>(config, path_to_testdir)) {
+      std::cout << "faild test (cubool) : " << config.test_name << std::endl;
+      return false;
+    }
+#endif
+    if (!run_algo<cpu_backend>(config, path_to_testdir)) {
+      std::cout << "faild test (cpu) : " << config.test_name << std::endl;
+      return false;
+    }
+    // small tiles so the test graphs span several of them
+    if (!run_algo<basic_tiled_backend<4>>(config, path_to_testdir)) {
+      std::cout << "faild test (tiled) : " << config.test_name << std::endl;
+      return false;
+    }
+    // a budget of two tiles, everything else lives in the spill file
+    basic_tiled_backend<4>::limit_memory(64, "cfra_spill.bin");
+    bool spilled = run_algo<basic_tiled_backend<4>>(config, path_to_testdir);
+    basic_tiled_backend<4>::unlimit_memory();
+    if (!spilled) {
+      std::cout << "faild test (tiled, spilled) : " << config.test_name
+                << std::endl;
+      return false;
+    }
+    if (!run_algo<single_path_backend>(config, path_to_testdir)) {
+      std::cout << "faild test (single path) : " << config.test_name
+                << std::endl;
+      return false;
+    }
+    if (!run_algo<tropical_backend>(config, path_to_testdir)) {
+      std::cout << "faild test (tropical) : " << config.test_name
+                << std::endl;
       return false;
     }
   }
@@ -80,4 +318,4 @@ bool test(const std::string &path_to_testdir) {
   return true;
 }
 
-int main() { return test("../test_data/"); }
+int main() { return test("../test_data/") ? 0 : 1; }
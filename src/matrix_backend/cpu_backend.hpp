@@ -0,0 +1,117 @@
+#pragma once
+#include "../bit_matrix/bit_matrix.hpp"
+#include <bit>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+// native packed bit matrices, no CUDA required
+struct cpu_backend {
+  using matrix = bit_matrix *;
+  using index = bit_matrix::index;
+  // distinct matrices may be used from several threads at once
+  static constexpr bool thread_safe = true;
+
+  static void initialize() {}
+
+  static void finalize() {}
+
+  static matrix new_matrix(size_t rows, size_t cols) {
+    return new bit_matrix(rows, cols);
+  }
+
+  static matrix duplicate(matrix m) { return new bit_matrix(*m); }
+
+  static void free(matrix m) { delete m; }
+
+  static void build(matrix m, const index *rows, const index *cols,
+                    size_t nvals) {
+    m->build(rows, cols, nvals);
+  }
+
+  static matrix identity(size_t size) {
+    matrix result = new_matrix(size, size);
+    for (size_t i = 0; i < size; i++)
+      result->set(i, i);
+    return result;
+  }
+
+  static size_t nvals(matrix m) { return m->nvals(); }
+
+  static std::vector<std::pair<index, index>> extract_pairs(matrix m) {
+    return m->extract_pairs();
+  }
+
+  static void accumulate(matrix &dst, matrix src) { *dst |= *src; }
+
+  // row of m |= bits, packed like a row of m
+  static void or_row(matrix m, index row, const bit_matrix::word *bits) {
+    bit_kernels::or_words(m->row(row), bits, m->words_per_row());
+  }
+
+  static matrix difference(matrix left, matrix right) {
+    matrix result = duplicate(left);
+    result->subtract(*right);
+    return result;
+  }
+
+  static matrix intersect(matrix left, matrix right) {
+    matrix result = duplicate(left);
+    *result &= *right;
+    return result;
+  }
+
+  static void mxm_accumulate(matrix result, matrix left, matrix right) {
+    bit_matrix::mxm(*result, *left, *right, true);
+  }
+
+  static size_t mxm_add(matrix &result, matrix left, matrix right,
+                        matrix &fresh) {
+    return bit_matrix::mxm_add(*result, *left, *right, *fresh);
+  }
+
+  // left and the members of targets point to handles, like
+  // matrix_utils::product_target
+  template <typename Target>
+  static std::vector<size_t> mxm_add_batch(const matrix *left,
+                                           const std::vector<Target> &targets) {
+    std::vector<bit_matrix::product_target> products;
+    for (const auto &target : targets)
+      products.push_back({*target.result, *target.right, *target.fresh});
+    return bit_matrix::mxm_add_batch(**left, products);
+  }
+
+  // products and their operands point to handles, like
+  // matrix_utils::product
+  template <typename Product>
+  static std::vector<size_t>
+  mxm_add_stacked(const std::vector<Product> &products) {
+    std::vector<bit_matrix::product> stacked;
+    for (const auto &p : products)
+      stacked.push_back({*p.result, *p.left, *p.right, *p.fresh});
+    return bit_matrix::mxm_add_stacked(stacked);
+  }
+
+  static matrix column_mask(matrix m) {
+    std::vector<bit_matrix::word> columns(m->words_per_row());
+    for (size_t i = 0; i < m->rows(); i++)
+      bit_kernels::or_words(columns.data(), m->row(i), columns.size());
+
+    matrix result = new_matrix(m->cols(), m->cols());
+    for (size_t w = 0; w < columns.size(); w++)
+      for (auto bits = columns[w]; bits != 0; bits &= bits - 1) {
+        size_t j = w * bit_matrix::word_bits + std::countr_zero(bits);
+        result->set(j, j);
+      }
+    return result;
+  }
+
+  static matrix kronecker(matrix left, matrix right) {
+    return new bit_matrix(bit_matrix::kronecker(*left, *right));
+  }
+
+  static matrix extract_block(matrix m, size_t row, size_t col, size_t rows,
+                              size_t cols) {
+    return new bit_matrix(m->block(row, col, rows, cols));
+  }
+};
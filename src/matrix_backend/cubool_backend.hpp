@@ -0,0 +1,174 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cubool.h>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+// matrices live in cuBool (CUDA, or its own CPU fallback)
+struct cubool_backend {
+  using matrix = cuBool_Matrix;
+  using index = cuBool_Index;
+
+  static void initialize() { cuBool_Initialize(CUBOOL_HINT_NO); }
+
+  static void finalize() { cuBool_Finalize(); }
+
+  static matrix new_matrix(size_t rows, size_t cols) {
+    matrix result;
+    cuBool_Matrix_New(&result, rows, cols);
+    return result;
+  }
+
+  static matrix duplicate(matrix m) {
+    matrix result;
+    cuBool_Matrix_Duplicate(m, &result);
+    return result;
+  }
+
+  static void free(matrix m) { cuBool_Matrix_Free(m); }
+
+  static void build(matrix m, const index *rows, const index *cols,
+                    size_t nvals) {
+    cuBool_Matrix_Build(m, rows, cols, nvals, CUBOOL_HINT_NO);
+  }
+
+  static matrix identity(size_t size) {
+    std::vector<index> diagonal(size);
+    for (size_t i = 0; i < size; i++)
+      diagonal[i] = i;
+    matrix result = new_matrix(size, size);
+    cuBool_Matrix_Build(result, diagonal.data(), diagonal.data(), size,
+                        CUBOOL_HINT_VALUES_SORTED);
+    return result;
+  }
+
+  static size_t nvals(matrix m) {
+    index result;
+    cuBool_Matrix_Nvals(m, &result);
+    return result;
+  }
+
+  static std::vector<std::pair<index, index>> extract_pairs(matrix m) {
+    index count = nvals(m);
+    std::vector<index> rows(count), cols(count);
+    cuBool_Matrix_ExtractPairs(m, rows.data(), cols.data(), &count);
+
+    std::vector<std::pair<index, index>> result(count);
+    for (index i = 0; i < count; i++)
+      result[i] = {rows[i], cols[i]};
+    std::sort(result.begin(), result.end());
+    return result;
+  }
+
+  static void accumulate(matrix &dst, matrix src) {
+    index rows, cols;
+    cuBool_Matrix_Nrows(dst, &rows);
+    cuBool_Matrix_Ncols(dst, &cols);
+    matrix result = new_matrix(rows, cols);
+    cuBool_Matrix_EWiseAdd(result, dst, src, CUBOOL_HINT_NO);
+    cuBool_Matrix_Free(dst);
+    dst = result;
+  }
+
+  // cuBool has no complement, the difference is taken on the host
+  static matrix difference(matrix left, matrix right) {
+    index rows, cols;
+    cuBool_Matrix_Nrows(left, &rows);
+    cuBool_Matrix_Ncols(left, &cols);
+    matrix common = new_matrix(rows, cols);
+    cuBool_Matrix_EWiseMult(common, left, right, CUBOOL_HINT_NO);
+    auto left_pairs = extract_pairs(left);
+    auto common_pairs = extract_pairs(common);
+    cuBool_Matrix_Free(common);
+
+    std::vector<std::pair<index, index>> pairs;
+    std::set_difference(left_pairs.begin(), left_pairs.end(),
+                        common_pairs.begin(), common_pairs.end(),
+                        std::back_inserter(pairs));
+    std::vector<index> result_rows, result_cols;
+    for (auto [row, col] : pairs) {
+      result_rows.push_back(row);
+      result_cols.push_back(col);
+    }
+
+    matrix result = new_matrix(rows, cols);
+    cuBool_Matrix_Build(result, result_rows.data(), result_cols.data(),
+                        result_rows.size(), CUBOOL_HINT_VALUES_SORTED);
+    return result;
+  }
+
+  static matrix intersect(matrix left, matrix right) {
+    index rows, cols;
+    cuBool_Matrix_Nrows(left, &rows);
+    cuBool_Matrix_Ncols(left, &cols);
+    matrix result = new_matrix(rows, cols);
+    cuBool_Matrix_EWiseMult(result, left, right, CUBOOL_HINT_NO);
+    return result;
+  }
+
+  static void mxm_accumulate(matrix result, matrix left, matrix right) {
+    cuBool_MxM(result, left, right, CUBOOL_HINT_ACCUMULATE);
+  }
+
+  // cuBool has no masked product: the product is added on the device and
+  // the change is read from Nvals, nothing goes through the host. fresh
+  // gets the whole product, a superset of the new entries.
+  static size_t mxm_add(matrix &result, matrix left, matrix right,
+                        matrix &fresh) {
+    index rows, cols;
+    cuBool_Matrix_Nrows(left, &rows);
+    cuBool_Matrix_Ncols(right, &cols);
+    matrix product = new_matrix(rows, cols);
+    cuBool_MxM(product, left, right, CUBOOL_HINT_NO);
+    size_t before = nvals(result);
+    accumulate(result, product);
+    size_t count = nvals(result) - before;
+    if (count != 0)
+      accumulate(fresh, product);
+    cuBool_Matrix_Free(product);
+    return count;
+  }
+
+  static matrix column_mask(matrix m) {
+    index rows, cols;
+    cuBool_Matrix_Nrows(m, &rows);
+    cuBool_Matrix_Ncols(m, &cols);
+    matrix transposed = new_matrix(cols, rows);
+    matrix reduced = new_matrix(cols, 1);
+    cuBool_Matrix_Transpose(transposed, m, CUBOOL_HINT_NO);
+    cuBool_Matrix_Reduce2(reduced, transposed, CUBOOL_HINT_NO);
+    auto pairs = extract_pairs(reduced);
+    cuBool_Matrix_Free(transposed);
+    cuBool_Matrix_Free(reduced);
+
+    std::vector<index> diagonal;
+    for (auto [row, col] : pairs)
+      diagonal.push_back(row);
+    matrix result = new_matrix(cols, cols);
+    cuBool_Matrix_Build(result, diagonal.data(), diagonal.data(),
+                        diagonal.size(), CUBOOL_HINT_VALUES_SORTED);
+    return result;
+  }
+
+  static matrix kronecker(matrix left, matrix right) {
+    index left_rows, left_cols, right_rows, right_cols;
+    cuBool_Matrix_Nrows(left, &left_rows);
+    cuBool_Matrix_Ncols(left, &left_cols);
+    cuBool_Matrix_Nrows(right, &right_rows);
+    cuBool_Matrix_Ncols(right, &right_cols);
+    matrix result =
+        new_matrix(left_rows * right_rows, left_cols * right_cols);
+    cuBool_Kronecker(result, left, right, CUBOOL_HINT_NO);
+    return result;
+  }
+
+  static matrix extract_block(matrix m, size_t row, size_t col, size_t rows,
+                              size_t cols) {
+    matrix result = new_matrix(rows, cols);
+    cuBool_Matrix_ExtractSubMatrix(result, m, row, col, rows, cols,
+                                   CUBOOL_HINT_NO);
+    return result;
+  }
+};
@@ -0,0 +1,75 @@
+#pragma once
+#include <concepts>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+// Compile-time matrix backend policy. A backend exposes an owning handle type
+// and static operations on it; the solver and label_decomposed_graph only
+// talk to matrices through these.
+template <typename B>
+concept matrix_backend =
+    requires(typename B::matrix matrix, typename B::matrix &handle,
+             const typename B::index *indices, size_t n) {
+      { B::new_matrix(n, n) } -> std::same_as<typename B::matrix>;
+      { B::duplicate(matrix) } -> std::same_as<typename B::matrix>;
+      B::free(matrix);
+      B::build(matrix, indices, indices, n);
+      // n x n matrix of epsilon entries on the diagonal
+      { B::identity(n) } -> std::same_as<typename B::matrix>;
+      { B::nvals(matrix) } -> std::convertible_to<size_t>;
+      {
+        B::extract_pairs(matrix)
+      } -> std::same_as<
+          std::vector<std::pair<typename B::index, typename B::index>>>;
+      // handle |= matrix, the handle may be replaced
+      B::accumulate(handle, matrix);
+      // new matrix with the entries of the first operand missing in the second
+      { B::difference(matrix, matrix) } -> std::same_as<typename B::matrix>;
+      // new matrix with the entries of the first operand present in the
+      // second
+      { B::intersect(matrix, matrix) } -> std::same_as<typename B::matrix>;
+      // result |= left x right, result must not alias an operand
+      B::mxm_accumulate(matrix, matrix, matrix);
+      // handle |= left x right in one pass, entries new to handle are also
+      // added to fresh; returns their number. fresh may get more of the
+      // product than is new where the backend has no masked kernel.
+      // Operands may alias handle.
+      { B::mxm_add(handle, matrix, matrix, handle) } -> std::convertible_to<size_t>;
+      // diagonal matrix with (j, j) for every non-empty column j
+      { B::column_mask(matrix) } -> std::same_as<typename B::matrix>;
+      { B::kronecker(matrix, matrix) } -> std::same_as<typename B::matrix>;
+      // n x n sub-matrix with the top left corner at (i, j)
+      { B::extract_block(matrix, n, n, n, n) } -> std::same_as<typename B::matrix>;
+    };
+
+// backends whose entries carry the length of a path
+template <typename B>
+concept length_backend =
+    matrix_backend<B> && requires(typename B::matrix matrix, size_t i) {
+      B::get(matrix, i, i)->length;
+    };
+
+// backends whose entries remember how they were derived
+template <typename B>
+concept witness_backend =
+    length_backend<B> && requires(typename B::matrix matrix, size_t i) {
+      B::get(matrix, i, i)->height;
+      B::get(matrix, i, i)->middle;
+      B::semiring::no_middle;
+    };
+
+#include "cpu_backend.hpp"
+#include "semiring_backend.hpp"
+#include "tiled_backend.hpp"
+#ifndef CFRA_CPU_BACKEND
+#include "cubool_backend.hpp"
+static_assert(matrix_backend<cubool_backend>);
+using default_backend = cubool_backend;
+#else
+using default_backend = cpu_backend;
+#endif
+static_assert(matrix_backend<cpu_backend>);
+static_assert(matrix_backend<tiled_backend>);
+static_assert(witness_backend<single_path_backend>);
+static_assert(length_backend<tropical_backend>);
@@ -0,0 +1,102 @@
+#pragma once
+#include "../semiring_matrix/semiring_matrix.hpp"
+#include "../semiring_matrix/single_path.hpp"
+#include "../semiring_matrix/tropical.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+// valued sparse matrices on the CPU; graph edges get Semiring::edge(), the
+// identity gets Semiring::identity(). Only the all-pairs solve() gives the
+// values their meaning: masks of the multiple-source mode would show up as
+// middle vertices.
+template <typename Semiring> struct semiring_backend {
+  using semiring = Semiring;
+  using matrix = semiring_matrix<Semiring> *;
+  using index = typename semiring_matrix<Semiring>::index;
+  using value = typename Semiring::value;
+  // distinct matrices may be used from several threads at once
+  static constexpr bool thread_safe = true;
+
+  static void initialize() {}
+
+  static void finalize() {}
+
+  static matrix new_matrix(size_t rows, size_t cols) {
+    return new semiring_matrix<Semiring>(rows, cols);
+  }
+
+  static matrix duplicate(matrix m) {
+    return new semiring_matrix<Semiring>(*m);
+  }
+
+  static void free(matrix m) { delete m; }
+
+  static void build(matrix m, const index *rows, const index *cols,
+                    size_t nvals) {
+    m->build(rows, cols, nvals, Semiring::edge());
+  }
+
+  static matrix identity(size_t size) {
+    std::vector<index> diagonal(size);
+    for (size_t i = 0; i < size; i++)
+      diagonal[i] = i;
+    matrix result = new_matrix(size, size);
+    result->build(diagonal.data(), diagonal.data(), size,
+                  Semiring::identity());
+    return result;
+  }
+
+  static size_t nvals(matrix m) { return m->nvals(); }
+
+  static std::vector<std::pair<index, index>> extract_pairs(matrix m) {
+    return m->extract_pairs();
+  }
+
+  static const value *get(matrix m, index i, index j) { return m->get(i, j); }
+
+  static void accumulate(matrix &dst, matrix src) { *dst |= *src; }
+
+  static matrix difference(matrix left, matrix right) {
+    return new semiring_matrix<Semiring>(left->difference(*right));
+  }
+
+  static matrix intersect(matrix left, matrix right) {
+    return new semiring_matrix<Semiring>(left->intersection(*right));
+  }
+
+  static void mxm_accumulate(matrix result, matrix left, matrix right) {
+    semiring_matrix<Semiring>::mxm(*result, *left, *right);
+  }
+
+  static size_t mxm_add(matrix &result, matrix left, matrix right,
+                        matrix &fresh) {
+    return semiring_matrix<Semiring>::mxm_add(*result, *left, *right, *fresh);
+  }
+
+  static matrix column_mask(matrix m) {
+    std::vector<index> columns;
+    for (auto [i, j] : m->extract_pairs())
+      columns.push_back(j);
+    std::sort(columns.begin(), columns.end());
+    columns.erase(std::unique(columns.begin(), columns.end()), columns.end());
+    matrix result = new_matrix(m->cols(), m->cols());
+    result->build(columns.data(), columns.data(), columns.size(),
+                  Semiring::identity());
+    return result;
+  }
+
+  static matrix kronecker(matrix left, matrix right) {
+    return new semiring_matrix<Semiring>(
+        semiring_matrix<Semiring>::kronecker(*left, *right));
+  }
+
+  static matrix extract_block(matrix m, size_t row, size_t col, size_t rows,
+                              size_t cols) {
+    return new semiring_matrix<Semiring>(m->block(row, col, rows, cols));
+  }
+};
+
+using single_path_backend = semiring_backend<single_path_semiring>;
+using tropical_backend = semiring_backend<tropical_semiring>;
@@ -0,0 +1,120 @@
+#pragma once
+#include "../tiled_matrix/tiled_matrix.hpp"
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+
+// tiled bit matrices on the CPU, products are parallel over result tiles
+template <size_t TileSize> struct basic_tiled_backend {
+  using matrix = tiled_matrix<TileSize> *;
+  using index = typename tiled_matrix<TileSize>::index;
+  // distinct matrices may be used from several threads at once
+  static constexpr bool thread_safe = true;
+
+  static void initialize() {}
+
+  static void finalize() {}
+
+  // Out-of-core mode: at most budget bytes of tiles stay in memory, cold
+  // tiles of every matrix go to a spill file at path and are read back when
+  // a product needs them.
+  static void limit_memory(size_t budget, const std::string &path) {
+    tile_spill::instance().limit(budget, path);
+  }
+
+  static void unlimit_memory() { tile_spill::instance().unlimit(); }
+
+  static matrix new_matrix(size_t rows, size_t cols) {
+    return new tiled_matrix<TileSize>(rows, cols);
+  }
+
+  static matrix duplicate(matrix m) { return new tiled_matrix<TileSize>(*m); }
+
+  static void free(matrix m) { delete m; }
+
+  static void build(matrix m, const index *rows, const index *cols,
+                    size_t nvals) {
+    m->build(rows, cols, nvals);
+  }
+
+  static matrix identity(size_t size) {
+    matrix result = new_matrix(size, size);
+    for (size_t i = 0; i < size; i++)
+      result->set(i, i);
+    return result;
+  }
+
+  static size_t nvals(matrix m) { return m->nvals(); }
+
+  static std::vector<std::pair<index, index>> extract_pairs(matrix m) {
+    return m->extract_pairs();
+  }
+
+  static void accumulate(matrix &dst, matrix src) { *dst |= *src; }
+
+  // row of m |= bits, packed like a bit_matrix row
+  static void or_row(matrix m, index row, const bit_matrix::word *bits) {
+    m->or_row(row, bits);
+  }
+
+  static matrix difference(matrix left, matrix right) {
+    matrix result = duplicate(left);
+    result->subtract(*right);
+    return result;
+  }
+
+  static matrix intersect(matrix left, matrix right) {
+    matrix result = duplicate(left);
+    *result &= *right;
+    return result;
+  }
+
+  static void mxm_accumulate(matrix result, matrix left, matrix right) {
+    tiled_matrix<TileSize>::mxm_add(*result, *left, *right, nullptr);
+  }
+
+  static size_t mxm_add(matrix &result, matrix left, matrix right,
+                        matrix &fresh) {
+    return tiled_matrix<TileSize>::mxm_add(*result, *left, *right, fresh);
+  }
+
+  // left and the members of targets point to handles, like
+  // matrix_utils::product_target
+  template <typename Target>
+  static std::vector<size_t> mxm_add_batch(const matrix *left,
+                                           const std::vector<Target> &targets) {
+    std::vector<typename tiled_matrix<TileSize>::product_target> products;
+    for (const auto &target : targets)
+      products.push_back({*target.result, *target.right, *target.fresh});
+    return tiled_matrix<TileSize>::mxm_add_batch(**left, products);
+  }
+
+  // products and their operands point to handles, like
+  // matrix_utils::product
+  template <typename Product>
+  static std::vector<size_t>
+  mxm_add_stacked(const std::vector<Product> &products) {
+    std::vector<typename tiled_matrix<TileSize>::product> stacked;
+    for (const auto &p : products)
+      stacked.push_back({*p.result, *p.left, *p.right, *p.fresh});
+    return tiled_matrix<TileSize>::mxm_add_stacked(stacked);
+  }
+
+  static matrix column_mask(matrix m) {
+    return new tiled_matrix<TileSize>(m->column_mask());
+  }
+
+  static matrix kronecker(matrix left, matrix right) {
+    return new tiled_matrix<TileSize>(
+        tiled_matrix<TileSize>::kronecker(*left, *right));
+  }
+
+  static matrix extract_block(matrix m, size_t row, size_t col, size_t rows,
+                              size_t cols) {
+    return new tiled_matrix<TileSize>(m->block(row, col, rows, cols));
+  }
+};
+
+// 1024 x 1024 bit tiles take 128 KiB, a few of them stay in L2
+using tiled_backend = basic_tiled_backend<1024>;
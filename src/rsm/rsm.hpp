@@ -0,0 +1,115 @@
+#pragma once
+#include "../cnf_grammar/cnf_grammar.hpp"
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+// Recursive state machine: one box (finite automaton) per nonterminal, the
+// transitions are labelled with terminals or nonterminals. States of all boxes
+// are numbered together.
+class rsm {
+public:
+  using symbol = cnf_grammar::symbol;
+
+  struct box {
+    size_t start{};
+    std::set<size_t> finals;
+  };
+
+  symbol start_nonterm_{};
+  size_t states_count_{};
+  std::map<symbol, box> boxes_;
+  std::vector<std::tuple<size_t, symbol, size_t>> transitions_;
+
+  rsm() {}
+
+  // from a cnf_grammar, every rule becomes a path through its box
+  rsm(const cnf_grammar &grammar) : start_nonterm_(grammar.start_nonterm_) {
+    for (const symbol &lhs : grammar.epsilon_rules_)
+      add_production(lhs, {});
+    for (const auto &[lhs, rhs] : grammar.simple_rules_)
+      add_production(lhs, {rhs});
+    for (const auto &[lhs, rhs1, rhs2] : grammar.complex_rules_)
+      add_production(lhs, {rhs1, rhs2});
+  }
+
+  // load from a context-free grammar file in the pocr layout without the CNF
+  // restriction: "A X1 X2 ... Xk" per production (k may be 0), then "Count:"
+  // and the start nonterminal
+  rsm(const std::string &path) {
+    std::ifstream infile(path);
+    if (!infile.is_open()) {
+      std::cerr << "Unable to open file: " << path << std::endl;
+      return;
+    }
+
+    std::string line;
+    while (std::getline(infile, line)) {
+      std::istringstream iss(line);
+      std::vector<symbol> parts;
+      std::string word;
+      while (iss >> word)
+        parts.emplace_back(word);
+      if (parts.empty())
+        continue;
+
+      if (parts.size() == 1 && parts[0].label_ == "Count:") {
+        std::getline(infile, line);
+        std::istringstream start(line);
+        start >> word;
+        start_nonterm_ = symbol(word);
+        break;
+      }
+      add_production(parts[0],
+                     std::vector<symbol>(parts.begin() + 1, parts.end()));
+    }
+  }
+
+  rsm(const rsm &other) = default;
+
+  rsm &operator=(const rsm &other) = default;
+
+  // productions of one nonterminal share their common prefixes
+  void add_production(const symbol &lhs, const std::vector<symbol> &rhs) {
+    auto [it, inserted] = boxes_.try_emplace(lhs);
+    if (inserted)
+      it->second.start = states_count_++;
+
+    size_t state = it->second.start;
+    for (const symbol &s : rhs) {
+      auto next = std::find_if(
+          transitions_.begin(), transitions_.end(), [&](const auto &t) {
+            return std::get<0>(t) == state && std::get<1>(t).label_ == s.label_;
+          });
+      if (next != transitions_.end()) {
+        state = std::get<2>(*next);
+      } else {
+        transitions_.emplace_back(state, s, states_count_);
+        state = states_count_++;
+      }
+    }
+    it->second.finals.insert(state);
+  }
+
+  std::set<symbol> non_terminals() const {
+    std::set<symbol> result;
+    for (const auto &[nonterm, b] : boxes_)
+      result.insert(nonterm);
+    return result;
+  }
+
+  std::set<symbol> labels() const {
+    std::set<symbol> result;
+    for (const auto &[from, label, to] : transitions_)
+      result.insert(label);
+    return result;
+  }
+
+  ~rsm() {}
+};
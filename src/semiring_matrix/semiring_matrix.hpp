@@ -0,0 +1,247 @@
+#pragma once
+#include "../bit_matrix/bit_matrix.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Sparse matrix whose entries carry a value of Semiring::value. A semiring
+// provides
+//   value edge()                      value of a labelled graph edge
+//   value identity()                  value of an epsilon (diagonal) entry
+//   value multiply(a, b, k)           (i, k) = a and (k, j) = b give (i, j)
+//   bool improves(candidate, current) whether candidate replaces current
+// An entry is only ever replaced by an improving value, so adding entries is
+// monotone and a fixpoint over these matrices terminates as long as values
+// cannot improve forever.
+template <typename Semiring> class semiring_matrix {
+public:
+  using index = uint32_t;
+  using value = typename Semiring::value;
+  using entry = std::pair<index, value>;
+
+private:
+  size_t rows_{};
+  size_t cols_{};
+  // rows are sorted by column
+  std::vector<std::vector<entry>> data_;
+
+  // dst (+)= src, both sorted by column
+  static void merge_row(std::vector<entry> &dst, const std::vector<entry> &src) {
+    if (src.empty())
+      return;
+    std::vector<entry> result;
+    result.reserve(dst.size() + src.size());
+    auto a = dst.begin(), b = src.begin();
+    while (a != dst.end() || b != src.end()) {
+      if (b == src.end() || (a != dst.end() && a->first < b->first)) {
+        result.push_back(*a++);
+      } else if (a == dst.end() || b->first < a->first) {
+        result.push_back(*b++);
+      } else {
+        result.push_back(Semiring::improves(b->second, a->second) ? *b : *a);
+        ++a, ++b;
+      }
+    }
+    dst = std::move(result);
+  }
+
+public:
+  semiring_matrix() {}
+
+  semiring_matrix(size_t rows, size_t cols)
+      : rows_(rows), cols_(cols), data_(rows) {}
+
+  size_t rows() const { return rows_; }
+  size_t cols() const { return cols_; }
+
+  const std::vector<entry> &row(size_t i) const { return data_[i]; }
+
+  const value *get(size_t i, size_t j) const {
+    auto it = std::lower_bound(
+        data_[i].begin(), data_[i].end(), j,
+        [](const entry &e, size_t col) { return e.first < col; });
+    return it != data_[i].end() && it->first == j ? &it->second : nullptr;
+  }
+
+  void clear() {
+    for (auto &r : data_)
+      r.clear();
+  }
+
+  size_t nvals() const {
+    size_t result = 0;
+    for (const auto &r : data_)
+      result += r.size();
+    return result;
+  }
+
+  void build(const index *rows, const index *cols, size_t nvals, value v) {
+    clear();
+    for (size_t i = 0; i < nvals; i++)
+      data_[rows[i]].emplace_back(cols[i], v);
+    for (auto &r : data_) {
+      std::sort(r.begin(), r.end(), [](const entry &a, const entry &b) {
+        return a.first < b.first;
+      });
+      r.erase(std::unique(r.begin(), r.end(),
+                          [](const entry &a, const entry &b) {
+                            return a.first == b.first;
+                          }),
+              r.end());
+    }
+  }
+
+  // row-major order
+  std::vector<std::pair<index, index>> extract_pairs() const {
+    std::vector<std::pair<index, index>> result;
+    for (size_t i = 0; i < rows_; i++)
+      for (const auto &[j, v] : data_[i])
+        result.emplace_back(i, j);
+    return result;
+  }
+
+  semiring_matrix &operator|=(const semiring_matrix &other) {
+    for (size_t i = 0; i < rows_; i++)
+      merge_row(data_[i], other.data_[i]);
+    return *this;
+  }
+
+  // entries of this that other does not have or that improve on other
+  semiring_matrix difference(const semiring_matrix &other) const {
+    semiring_matrix result(rows_, cols_);
+    for (size_t i = 0; i < rows_; i++)
+      for (const auto &[j, v] : data_[i]) {
+        const value *known = other.get(i, j);
+        if (known == nullptr || Semiring::improves(v, *known))
+          result.data_[i].emplace_back(j, v);
+      }
+    return result;
+  }
+
+  // entries of this whose position other has, values are kept
+  semiring_matrix intersection(const semiring_matrix &other) const {
+    semiring_matrix result(rows_, cols_);
+    for (size_t i = 0; i < rows_; i++)
+      for (const auto &[j, v] : data_[i])
+        if (other.get(i, j) != nullptr)
+          result.data_[i].emplace_back(j, v);
+    return result;
+  }
+
+  semiring_matrix block(size_t row, size_t col, size_t rows,
+                        size_t cols) const {
+    semiring_matrix result(rows, cols);
+    for (size_t i = 0; i < rows; i++)
+      for (const auto &[j, v] : data_[row + i])
+        if (j >= col && j < col + cols)
+          result.data_[i].emplace_back(j - col, v);
+    return result;
+  }
+
+  // values are taken from the right operand
+  static semiring_matrix kronecker(const semiring_matrix &left,
+                                   const semiring_matrix &right) {
+    semiring_matrix result(left.rows_ * right.rows_, left.cols_ * right.cols_);
+    for (size_t i = 0; i < left.rows_; i++)
+      for (const auto &[j, unused] : left.data_[i])
+        for (size_t k = 0; k < right.rows_; k++)
+          for (const auto &[l, v] : right.data_[k])
+            result.data_[i * right.rows_ + k].emplace_back(j * right.cols_ + l,
+                                                           v);
+    return result;
+  }
+
+  // result (+)= left x right, the entries the product adds to result or
+  // improves are also merged into fresh and counted. Candidates are masked
+  // with row i of result, so known entries that would not improve are never
+  // accumulated. Operands may alias result, they are read from a snapshot
+  // then.
+  static size_t mxm_add(semiring_matrix &result, const semiring_matrix &left,
+                        const semiring_matrix &right, semiring_matrix &fresh) {
+    if (&left == &result || &right == &result) {
+      semiring_matrix snapshot(result);
+      return mxm_add(result, &left == &result ? snapshot : left,
+                     &right == &result ? snapshot : right, fresh);
+    }
+
+    std::atomic<size_t> added = 0;
+    bit_kernels::parallel_rows(left.rows_, [&](size_t begin, size_t end) {
+      // seen: 1 for a known entry of result, 2 for a produced one
+      std::vector<value> accumulator(right.cols_);
+      std::vector<char> seen(right.cols_, 0);
+      std::vector<index> touched;
+      std::vector<entry> changed;
+      size_t count = 0;
+      for (size_t i = begin; i < end; i++) {
+        if (left.data_[i].empty())
+          continue;
+        for (const auto &[j, v] : result.data_[i]) {
+          seen[j] = 1;
+          accumulator[j] = v;
+        }
+        for (const auto &[k, a] : left.data_[i])
+          for (const auto &[j, b] : right.data_[k]) {
+            value candidate = Semiring::multiply(a, b, k);
+            if (seen[j] == 0 || Semiring::improves(candidate, accumulator[j])) {
+              if (seen[j] != 2)
+                touched.push_back(j);
+              seen[j] = 2;
+              accumulator[j] = candidate;
+            }
+          }
+        for (const auto &[j, v] : result.data_[i])
+          seen[j] = 0;
+        if (touched.empty())
+          continue;
+
+        std::sort(touched.begin(), touched.end());
+        changed.clear();
+        for (index j : touched) {
+          changed.emplace_back(j, accumulator[j]);
+          seen[j] = 0;
+        }
+        touched.clear();
+        count += changed.size();
+        merge_row(result.data_[i], changed);
+        merge_row(fresh.data_[i], changed);
+      }
+      added += count;
+    });
+    return added;
+  }
+
+  // result (+)= left x right, a dense accumulator per thread collects row i
+  static void mxm(semiring_matrix &result, const semiring_matrix &left,
+                  const semiring_matrix &right) {
+    bit_kernels::parallel_rows(left.rows_, [&](size_t begin, size_t end) {
+      std::vector<value> accumulator(right.cols_);
+      std::vector<char> seen(right.cols_, 0);
+      std::vector<index> touched;
+      std::vector<entry> product;
+      for (size_t i = begin; i < end; i++) {
+        for (const auto &[k, a] : left.data_[i])
+          for (const auto &[j, b] : right.data_[k]) {
+            value candidate = Semiring::multiply(a, b, k);
+            if (!seen[j]) {
+              seen[j] = 1;
+              accumulator[j] = candidate;
+              touched.push_back(j);
+            } else if (Semiring::improves(candidate, accumulator[j])) {
+              accumulator[j] = candidate;
+            }
+          }
+        std::sort(touched.begin(), touched.end());
+        product.clear();
+        for (index j : touched) {
+          product.emplace_back(j, accumulator[j]);
+          seen[j] = 0;
+        }
+        touched.clear();
+        merge_row(result.data_[i], product);
+      }
+    });
+  }
+};
@@ -0,0 +1,28 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+
+// Single-path semantics: every pair remembers how it was first derived. The
+// middle vertex splits the path, the height of the derivation tree is what
+// keeps a witness reconstruction from running in circles.
+struct single_path_semiring {
+  static constexpr uint32_t no_middle = std::numeric_limits<uint32_t>::max();
+
+  struct value {
+    uint32_t length{};
+    uint32_t height{};
+    uint32_t middle = no_middle;
+  };
+
+  static value edge() { return {1, 1, no_middle}; }
+
+  static value identity() { return {0, 1, no_middle}; }
+
+  static value multiply(value a, value b, uint32_t k) {
+    return {a.length + b.length, std::max(a.height, b.height) + 1, k};
+  }
+
+  // a derived pair is never replaced, so its witness stays valid
+  static bool improves(value, value) { return false; }
+};
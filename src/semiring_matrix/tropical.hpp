@@ -0,0 +1,23 @@
+#pragma once
+#include <cstdint>
+
+// Min-plus semiring: every pair keeps the length of its shortest path that
+// the grammar derives. Lengths only decrease and are bounded by zero, so the
+// fixpoint converges.
+struct tropical_semiring {
+  struct value {
+    uint32_t length{};
+  };
+
+  static value edge() { return {1}; }
+
+  static value identity() { return {0}; }
+
+  static value multiply(value a, value b, uint32_t) {
+    return {a.length + b.length};
+  }
+
+  static bool improves(value candidate, value current) {
+    return candidate.length < current.length;
+  }
+};
@@ -0,0 +1,148 @@
+#pragma once
+
+#include "../base_algo/matrix_utils.hpp"
+#include "../label_decomposed_graph/label_decomposed_graph.hpp"
+#include "../rsm/rsm.hpp"
+#include <map>
+#include <string>
+#include <vector>
+
+// Tensor-product CFPQ: the grammar is kept as a recursive state machine and
+// the graph is intersected with it through Kronecker products, so grammars
+// do not have to be converted to CNF.
+template <matrix_backend Backend = default_backend> class tensor_algo {
+public:
+  using matrix = typename Backend::matrix;
+  using index = typename Backend::index;
+
+private:
+  rsm Grammar;
+  label_decomposed_graph<Backend> Graph;
+  label_decomposed_graph<Backend> m;
+  using symbol = rsm::symbol;
+  using utils = matrix_utils<Backend>;
+  bool solved = false;
+
+  // closure = (closure | added)+, closure has to be transitively closed
+  static void close(matrix &closure, matrix added, size_t size) {
+    matrix delta = Backend::difference(added, closure);
+    Backend::accumulate(closure, delta);
+    while (Backend::nvals(delta) != 0) {
+      matrix derived = Backend::new_matrix(size, size);
+      Backend::mxm_accumulate(derived, delta, closure);
+      Backend::mxm_accumulate(derived, closure, delta);
+      Backend::free(delta);
+      delta = Backend::difference(derived, closure);
+      Backend::free(derived);
+      Backend::accumulate(closure, delta);
+    }
+    Backend::free(delta);
+  }
+
+public:
+  size_t matrix_size{};
+
+  tensor_algo() {}
+  tensor_algo(const rsm &grammar, const label_decomposed_graph<Backend> &graph)
+      : Grammar(grammar), Graph(graph), m(graph),
+        matrix_size(graph.matrix_size) {}
+
+  tensor_algo(const std::string &path_to_gramar,
+              const std::string &path_to_graph)
+      : Grammar(path_to_gramar), Graph(path_to_graph), m(Graph),
+        matrix_size(Graph.matrix_size) {}
+
+  // Every round adds M_l (x) delta(G_l) to the product graph of the RSM and
+  // the input graph, closes it transitively and reads the pairs of every
+  // nonterminal off the (start, final) blocks of the closure. Runs once,
+  // later calls reuse the result.
+  void run() {
+    if (solved)
+      return;
+    solved = true;
+
+    size_t states = Grammar.states_count_;
+    size_t product_size = states * matrix_size;
+
+    label_decomposed_graph<Backend> automaton(states);
+    std::map<std::string, std::pair<std::vector<index>, std::vector<index>>>
+        transitions;
+    for (const auto &[from, label, to] : Grammar.transitions_) {
+      transitions[label].first.push_back(from);
+      transitions[label].second.push_back(to);
+    }
+    for (auto &[label, pairs] : transitions)
+      Backend::build(automaton[label], pairs.first.data(), pairs.second.data(),
+                     pairs.first.size());
+
+    // nonterminals whose box accepts the empty word
+    matrix identity = Backend::identity(matrix_size);
+    for (const auto &[nonterm, b] : Grammar.boxes_)
+      if (b.finals.contains(b.start))
+        Backend::accumulate(m[nonterm], identity);
+    Backend::free(identity);
+
+    std::map<std::string, matrix> delta;
+    for (const auto &[label, pairs] : transitions)
+      if (Backend::nvals(m[label]) != 0)
+        delta[label] = Backend::duplicate(m[label]);
+
+    matrix closure = Backend::new_matrix(product_size, product_size);
+    while (!delta.empty()) {
+      matrix added = Backend::new_matrix(product_size, product_size);
+      for (const auto &[label, changes] : delta) {
+        matrix product = Backend::kronecker(automaton[label], changes);
+        Backend::accumulate(added, product);
+        Backend::free(product);
+      }
+      utils::free_all(delta);
+      close(closure, added, product_size);
+      Backend::free(added);
+
+      std::map<std::string, matrix> derived;
+      for (const auto &[nonterm, b] : Grammar.boxes_)
+        for (size_t final : b.finals) {
+          matrix block =
+              Backend::extract_block(closure, b.start * matrix_size,
+                                     final * matrix_size, matrix_size,
+                                     matrix_size);
+          Backend::accumulate(utils::entry(derived, nonterm, matrix_size),
+                              block);
+          Backend::free(block);
+        }
+      delta = utils::merge_new(m, derived);
+      // pairs of nonterminals that label no transition change nothing
+      std::erase_if(delta, [&](const auto &item) {
+        if (transitions.contains(item.first))
+          return false;
+        Backend::free(item.second);
+        return true;
+      });
+    }
+    Backend::free(closure);
+  }
+
+  // Returned matrix is owned by the caller.
+  matrix solve() {
+    run();
+    return Backend::duplicate(m[Grammar.start_nonterm_]);
+  }
+
+  // every nonterminal from the same fixpoint, matrices are owned by the caller
+  std::map<std::string, matrix> solve_all() {
+    std::vector<std::string> nonterms;
+    for (const symbol &nonterm : Grammar.non_terminals())
+      nonterms.push_back(nonterm);
+    return solve_all(nonterms);
+  }
+
+  std::map<std::string, matrix>
+  solve_all(const std::vector<std::string> &nonterms) {
+    run();
+    std::map<std::string, matrix> result;
+    for (const auto &nonterm : nonterms)
+      result[nonterm] = Backend::duplicate(m[nonterm]);
+    return result;
+  }
+  ~tensor_algo() {}
+};
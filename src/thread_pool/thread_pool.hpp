@@ -0,0 +1,178 @@
+#pragma once
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// fixed set of worker threads running submitted tasks, wait() blocks until
+// every submitted task has finished
+class thread_pool {
+  std::vector<std::thread> workers_;
+  std::queue<std::function<void()>> tasks_;
+  std::mutex mutex_;
+  std::condition_variable available_;
+  std::condition_variable finished_;
+  size_t pending_{};
+  bool stopping_{};
+
+  static bool &worker_flag() {
+    thread_local bool flag = false;
+    return flag;
+  }
+
+  void work() {
+    worker_flag() = true;
+    while (true) {
+      std::function<void()> task;
+      {
+        std::unique_lock lock(mutex_);
+        available_.wait(lock, [&] { return stopping_ || !tasks_.empty(); });
+        if (tasks_.empty())
+          return;
+        task = std::move(tasks_.front());
+        tasks_.pop();
+      }
+      task();
+      std::lock_guard lock(mutex_);
+      if (--pending_ == 0)
+        finished_.notify_all();
+    }
+  }
+
+public:
+  explicit thread_pool(size_t threads = std::thread::hardware_concurrency()) {
+    for (size_t i = 0; i < std::max<size_t>(threads, 1); i++)
+      workers_.emplace_back([this] { work(); });
+  }
+
+  thread_pool(const thread_pool &) = delete;
+  thread_pool &operator=(const thread_pool &) = delete;
+
+  void submit(std::function<void()> task) {
+    {
+      std::lock_guard lock(mutex_);
+      tasks_.push(std::move(task));
+      pending_++;
+    }
+    available_.notify_one();
+  }
+
+  void wait() {
+    std::unique_lock lock(mutex_);
+    finished_.wait(lock, [&] { return pending_ == 0; });
+  }
+
+  size_t size() const { return workers_.size(); }
+
+  // f(i) for every i in [0, count), with work stealing: every participant
+  // starts on its own contiguous share and, once that runs out, steals the
+  // upper half of the largest share left. The caller takes part; inside a
+  // worker everything runs on the calling thread. The first exception thrown
+  // by f is rethrown to the caller once every participant has stopped.
+  template <typename F> void parallel_for(size_t count, F &&f) {
+    if (in_worker() || count <= 1 || workers_.empty()) {
+      for (size_t i = 0; i < count; i++)
+        f(i);
+      return;
+    }
+
+    struct share {
+      std::mutex mutex;
+      size_t begin{};
+      size_t end{};
+    };
+    size_t parts = std::min(count, workers_.size() + 1);
+    std::vector<share> shares(parts);
+    for (size_t p = 0; p < parts; p++) {
+      shares[p].begin = count * p / parts;
+      shares[p].end = count * (p + 1) / parts;
+    }
+
+    auto run = [&](size_t own) {
+      while (true) {
+        bool found = false;
+        size_t i = 0;
+        {
+          std::lock_guard lock(shares[own].mutex);
+          if (shares[own].begin < shares[own].end) {
+            i = shares[own].begin++;
+            found = true;
+          }
+        }
+        if (found) {
+          f(i);
+          continue;
+        }
+
+        size_t victim = parts, largest = 0;
+        for (size_t p = 0; p < parts; p++) {
+          std::lock_guard lock(shares[p].mutex);
+          if (shares[p].end - shares[p].begin > largest) {
+            largest = shares[p].end - shares[p].begin;
+            victim = p;
+          }
+        }
+        if (victim == parts)
+          return;
+
+        size_t begin, end;
+        {
+          std::lock_guard lock(shares[victim].mutex);
+          size_t left = shares[victim].end - shares[victim].begin;
+          if (left == 0)
+            continue;
+          end = shares[victim].end;
+          begin = end - (left + 1) / 2;
+          shares[victim].end = begin;
+        }
+        std::lock_guard lock(shares[own].mutex);
+        shares[own].begin = begin;
+        shares[own].end = end;
+      }
+    };
+
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    auto guarded = [&](size_t own) {
+      try {
+        run(own);
+      } catch (...) {
+        std::lock_guard lock(error_mutex);
+        if (!error)
+          error = std::current_exception();
+      }
+    };
+    for (size_t p = 1; p < parts; p++)
+      submit([&guarded, p] { guarded(p); });
+    worker_flag() = true;
+    guarded(0);
+    worker_flag() = false;
+    wait();
+    if (error)
+      std::rethrow_exception(error);
+  }
+
+  // whether the calling thread is a worker of some pool; kernels that split
+  // their own work across threads stay on one thread inside a worker
+  static bool in_worker() { return worker_flag(); }
+
+  static thread_pool &shared() {
+    static thread_pool pool;
+    return pool;
+  }
+
+  ~thread_pool() {
+    {
+      std::lock_guard lock(mutex_);
+      stopping_ = true;
+    }
+    available_.notify_all();
+    for (auto &worker : workers_)
+      worker.join();
+  }
+};
@@ -0,0 +1,220 @@
+#pragma once
+#include "../bit_matrix/bit_matrix.hpp"
+#include <cstddef>
+#include <cstdio>
+#include <limits>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+
+class tile_slot;
+
+// Keeps the resident tiles of all tiled matrices under a memory budget. When
+// a tile has to be allocated or loaded past the budget, the least recently
+// used tiles nobody holds are written to the spill file and dropped; they are
+// read back on their next use. Without a budget nothing is spilled. A failed
+// write leaves its tile resident and stops further spilling, a failed read
+// throws std::runtime_error.
+class tile_spill {
+  friend class tile_slot;
+
+  std::mutex mutex_;
+  size_t budget_ = std::numeric_limits<size_t>::max();
+  size_t resident_ = 0;
+  std::string path_;
+  std::FILE *file_ = nullptr;
+  // set once a write failed, nothing more is spilled
+  bool failed_ = false;
+  long end_ = 0;
+  // unused regions of the file, size -> offset
+  std::multimap<size_t, long> free_;
+  // resident slots, most recently used first
+  std::list<tile_slot *> recent_;
+
+  long allocate(size_t bytes) {
+    auto it = free_.find(bytes);
+    if (it != free_.end()) {
+      long offset = it->second;
+      free_.erase(it);
+      return offset;
+    }
+    long offset = end_;
+    end_ += bytes;
+    return offset;
+  }
+
+  void release(long offset, size_t bytes) { free_.emplace(bytes, offset); }
+
+  // false, with the tile still resident, if it could not be written
+  bool spill(tile_slot &slot);
+
+  // evicts until bytes more fit into the budget or nothing can be evicted
+  void make_room(size_t bytes);
+
+public:
+  static tile_spill &instance() {
+    static tile_spill spill;
+    return spill;
+  }
+
+  // at most budget bytes of tiles stay in memory, the rest goes to a file
+  // at path; tiles already resident are evicted on the next allocation
+  void limit(size_t budget, const std::string &path) {
+    std::lock_guard lock(mutex_);
+    budget_ = budget;
+    if (file_ == nullptr) {
+      path_ = path;
+      file_ = std::fopen(path.c_str(), "w+b");
+      if (file_ == nullptr)
+        throw std::runtime_error("Can't open spill file: " + path);
+    }
+  }
+
+  // no more spilling, spilled tiles are still read back on use
+  void unlimit() {
+    std::lock_guard lock(mutex_);
+    budget_ = std::numeric_limits<size_t>::max();
+  }
+
+  size_t resident() {
+    std::lock_guard lock(mutex_);
+    return resident_;
+  }
+
+  ~tile_spill() {
+    if (file_ != nullptr) {
+      std::fclose(file_);
+      std::remove(path_.c_str());
+    }
+  }
+};
+
+// One tile of a tiled matrix: absent, resident or spilled. read() and write()
+// return the tile pinned, it is not spilled while the pointer is held.
+class tile_slot {
+  friend class tile_spill;
+
+  std::shared_ptr<bit_matrix> tile_;
+  size_t rows_{};
+  size_t cols_{};
+  bool present_ = false;
+  // region in the spill file, -1 if there is none
+  long offset_ = -1;
+  // whether the region holds the current content
+  bool spilled_current_ = false;
+  std::list<tile_slot *>::iterator recent_;
+
+  size_t bytes() const { return rows_ * ((cols_ + 63) / 64) * 8; }
+
+  // under the lock of the spill manager
+  void touch(tile_spill &spill) {
+    if (tile_) {
+      spill.recent_.splice(spill.recent_.begin(), spill.recent_, recent_);
+      return;
+    }
+    spill.make_room(bytes());
+    tile_ = std::make_shared<bit_matrix>(rows_, cols_);
+    if (offset_ >= 0 && rows_ != 0 &&
+        (std::fseek(spill.file_, offset_, SEEK_SET) != 0 ||
+         std::fread(tile_->row(0), 1, bytes(), spill.file_) != bytes())) {
+      tile_.reset();
+      spill.resident_ -= bytes();
+      throw std::runtime_error("Can't read spilled tile from " + spill.path_);
+    }
+    spill.recent_.push_front(this);
+    recent_ = spill.recent_.begin();
+  }
+
+public:
+  tile_slot() {}
+
+  tile_slot(const tile_slot &) = delete;
+  tile_slot &operator=(const tile_slot &) = delete;
+
+  bool present() const { return present_; }
+
+  // nullptr for an absent tile
+  std::shared_ptr<const bit_matrix> read() {
+    tile_spill &spill = tile_spill::instance();
+    std::lock_guard lock(spill.mutex_);
+    if (!present_)
+      return nullptr;
+    touch(spill);
+    return tile_;
+  }
+
+  // allocated empty with the given size on first use, the spilled copy
+  // becomes stale
+  std::shared_ptr<bit_matrix> write(size_t rows, size_t cols) {
+    tile_spill &spill = tile_spill::instance();
+    std::lock_guard lock(spill.mutex_);
+    if (!present_) {
+      rows_ = rows;
+      cols_ = cols;
+      present_ = true;
+    }
+    touch(spill);
+    spilled_current_ = false;
+    return tile_;
+  }
+
+  void assign(const bit_matrix &tile) {
+    *write(tile.rows(), tile.cols()) = tile;
+  }
+
+  void reset() {
+    tile_spill &spill = tile_spill::instance();
+    std::lock_guard lock(spill.mutex_);
+    if (tile_) {
+      spill.resident_ -= bytes();
+      spill.recent_.erase(recent_);
+      tile_.reset();
+    }
+    if (offset_ >= 0)
+      spill.release(offset_, bytes());
+    offset_ = -1;
+    spilled_current_ = false;
+    present_ = false;
+  }
+
+  ~tile_slot() { reset(); }
+};
+
+inline bool tile_spill::spill(tile_slot &slot) {
+  size_t bytes = slot.bytes();
+  if (!slot.spilled_current_ && bytes != 0) {
+    if (slot.offset_ < 0)
+      slot.offset_ = allocate(bytes);
+    // flushed, so a full disk shows up here rather than on a later write
+    if (std::fseek(file_, slot.offset_, SEEK_SET) != 0 ||
+        std::fwrite(slot.tile_->row(0), 1, bytes, file_) != bytes ||
+        std::fflush(file_) != 0) {
+      failed_ = true;
+      return false;
+    }
+  }
+  slot.spilled_current_ = true;
+  resident_ -= bytes;
+  recent_.erase(slot.recent_);
+  slot.tile_.reset();
+  return true;
+}
+
+inline void tile_spill::make_room(size_t bytes) {
+  if (file_ != nullptr && !failed_) {
+    auto it = recent_.end();
+    while (resident_ + bytes > budget_ && it != recent_.begin()) {
+      tile_slot &slot = **--it;
+      // held by a kernel right now
+      if (slot.tile_.use_count() > 1)
+        continue;
+      it = std::next(it);
+      if (!spill(slot))
+        break;
+    }
+  }
+  resident_ += bytes;
+}
@@ -0,0 +1,497 @@
+#pragma once
+#include "../bit_matrix/bit_matrix.hpp"
+#include "../thread_pool/thread_pool.hpp"
+#include "tile_spill.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// boolean matrix split into TileSize x TileSize bit_matrix tiles (smaller at
+// the right and bottom edges); empty tiles are not stored and the others may
+// be spilled to disk under a memory budget (tile_spill). Products run one
+// task per result tile on the shared thread_pool and skip every pair of
+// tiles with an empty operand.
+template <size_t TileSize> class tiled_matrix {
+public:
+  using index = uint32_t;
+  static constexpr size_t tile_size = TileSize;
+
+private:
+  size_t rows_{};
+  size_t cols_{};
+  size_t tile_rows_{};
+  size_t tile_cols_{};
+  // row-major grid; reading a tile may load it back from the spill file
+  mutable std::vector<tile_slot> tiles_;
+
+  static size_t tiles_for(size_t n) { return (n + TileSize - 1) / TileSize; }
+
+  size_t height(size_t tile_row) const {
+    return std::min(TileSize, rows_ - tile_row * TileSize);
+  }
+
+  size_t width(size_t tile_col) const {
+    return std::min(TileSize, cols_ - tile_col * TileSize);
+  }
+
+  tile_slot &slot(size_t tile_row, size_t tile_col) const {
+    return tiles_[tile_row * tile_cols_ + tile_col];
+  }
+
+  // nullptr for an empty tile
+  std::shared_ptr<const bit_matrix> tile(size_t tile_row,
+                                         size_t tile_col) const {
+    return slot(tile_row, tile_col).read();
+  }
+
+  // tile at (tile_row, tile_col), allocated empty on first use
+  std::shared_ptr<bit_matrix> make_tile(size_t tile_row, size_t tile_col) {
+    return slot(tile_row, tile_col).write(height(tile_row), width(tile_col));
+  }
+
+  void drop_empty_tiles() {
+    for (auto &t : tiles_)
+      if (t.present() && t.read()->empty())
+        t.reset();
+  }
+
+  // where a product writes tile (tile_row, tile_col): result and fresh
+  // (fresh may be null), with their tiles once they exist
+  struct tile_target {
+    tiled_matrix *result;
+    tiled_matrix *fresh;
+    std::shared_ptr<bit_matrix> dst, out;
+  };
+
+  // dst |= a x right[i] for every target i through the batched bit_matrix
+  // kernel, returns the new entries per target. Targets whose tiles do not
+  // exist yet work on zeroed scratch tiles and only get real ones once the
+  // product adds bits, so sparse products leave no empty tiles behind.
+  static std::vector<size_t>
+  multiply_tile(const bit_matrix &a,
+                const std::vector<const bit_matrix *> &rights,
+                const std::vector<tile_target *> &targets, size_t tile_row,
+                size_t tile_col) {
+    // zeroed scratch tiles of this thread
+    thread_local std::vector<std::unique_ptr<bit_matrix>> spare;
+    std::vector<std::unique_ptr<bit_matrix>> taken;
+    size_t rows = a.rows(), cols = rights.front()->cols();
+    auto scratch = [&] {
+      auto it = std::find_if(spare.begin(), spare.end(), [&](const auto &m) {
+        return m->rows() == rows && m->cols() == cols;
+      });
+      if (it == spare.end()) {
+        taken.push_back(std::make_unique<bit_matrix>(rows, cols));
+      } else {
+        taken.push_back(std::move(*it));
+        spare.erase(it);
+      }
+      return taken.back().get();
+    };
+
+    // a target listed twice writes one tile, through the same scratch
+    std::vector<bit_matrix::product_target> products;
+    for (size_t i = 0; i < targets.size(); i++) {
+      tile_target &target = *targets[i];
+      size_t same = std::find(targets.begin(), targets.end(), &target) -
+                    targets.begin();
+      if (same < i) {
+        products.push_back({products[same].result, rights[i],
+                            products[same].fresh});
+        continue;
+      }
+      if (target.dst == nullptr &&
+          target.result->slot(tile_row, tile_col).present())
+        target.dst = target.result->make_tile(tile_row, tile_col);
+      if (target.out == nullptr && target.fresh != nullptr &&
+          target.fresh->slot(tile_row, tile_col).present())
+        target.out = target.fresh->make_tile(tile_row, tile_col);
+      products.push_back(
+          {target.dst != nullptr ? target.dst.get() : scratch(), rights[i],
+           target.out != nullptr ? target.out.get() : scratch()});
+    }
+    auto counts = bit_matrix::mxm_add_batch(a, products);
+
+    std::vector<size_t> total(targets.size(), 0);
+    for (size_t i = 0; i < targets.size(); i++)
+      total[std::find(targets.begin(), targets.end(), targets[i]) -
+            targets.begin()] += counts[i];
+    for (size_t i = 0; i < targets.size(); i++) {
+      tile_target &target = *targets[i];
+      if (total[i] == 0)
+        continue;
+      if (target.dst == nullptr) {
+        target.dst = target.result->make_tile(tile_row, tile_col);
+        *target.dst |= *products[i].result;
+        products[i].result->clear();
+      }
+      if (target.out == nullptr) {
+        if (target.fresh != nullptr) {
+          target.out = target.fresh->make_tile(tile_row, tile_col);
+          *target.out |= *products[i].fresh;
+        }
+        products[i].fresh->clear();
+      }
+    }
+    for (auto &m : taken)
+      spare.push_back(std::move(m));
+    return counts;
+  }
+
+public:
+  tiled_matrix() {}
+
+  tiled_matrix(size_t rows, size_t cols)
+      : rows_(rows), cols_(cols), tile_rows_(tiles_for(rows)),
+        tile_cols_(tiles_for(cols)), tiles_(tile_rows_ * tile_cols_) {}
+
+  tiled_matrix(const tiled_matrix &other)
+      : rows_(other.rows_), cols_(other.cols_), tile_rows_(other.tile_rows_),
+        tile_cols_(other.tile_cols_), tiles_(other.tiles_.size()) {
+    for (size_t t = 0; t < tiles_.size(); t++)
+      if (auto tile = other.tiles_[t].read())
+        tiles_[t].assign(*tile);
+  }
+
+  tiled_matrix(tiled_matrix &&other) = default;
+
+  size_t rows() const { return rows_; }
+  size_t cols() const { return cols_; }
+
+  bool get(size_t i, size_t j) const {
+    auto t = tile(i / TileSize, j / TileSize);
+    return t != nullptr && t->get(i % TileSize, j % TileSize);
+  }
+
+  void set(size_t i, size_t j) {
+    make_tile(i / TileSize, j / TileSize)->set(i % TileSize, j % TileSize);
+  }
+
+  void clear() {
+    for (auto &t : tiles_)
+      t.reset();
+  }
+
+  // row i |= bits, one bit per column packed like a bit_matrix row; only
+  // the tiles the row reaches are allocated
+  void or_row(size_t i, const bit_matrix::word *bits) {
+    size_t words = (cols_ + 63) / 64;
+    std::vector<bit_matrix::word> part((TileSize + 63) / 64);
+    for (size_t tile_col = 0; tile_col < tile_cols_; tile_col++) {
+      size_t first = tile_col * TileSize, count = width(tile_col);
+      bool any = false;
+      for (size_t w = 0; w * 64 < count; w++) {
+        size_t start = first + w * 64, at = start / 64, shift = start % 64;
+        bit_matrix::word x = bits[at] >> shift;
+        if (shift != 0 && at + 1 < words)
+          x |= bits[at + 1] << (64 - shift);
+        if (count - w * 64 < 64)
+          x &= (bit_matrix::word{1} << (count - w * 64)) - 1;
+        part[w] = x;
+        any |= x != 0;
+      }
+      if (any)
+        bit_kernels::or_words(
+            make_tile(i / TileSize, tile_col)->row(i % TileSize), part.data(),
+            (count + 63) / 64);
+    }
+  }
+
+  size_t nvals() const {
+    size_t result = 0;
+    for (auto &t : tiles_)
+      if (auto tile = t.read())
+        result += tile->nvals();
+    return result;
+  }
+
+  void build(const index *rows, const index *cols, size_t nvals) {
+    clear();
+    for (size_t i = 0; i < nvals; i++)
+      set(rows[i], cols[i]);
+  }
+
+  // f(i, j) for every entry of tile (tile_row, tile_col)
+  template <typename F>
+  void for_each_in_tile(size_t tile_row, size_t tile_col, F &&f) const {
+    auto t = tile(tile_row, tile_col);
+    if (t == nullptr)
+      return;
+    for (size_t r = 0; r < t->rows(); r++) {
+      const bit_matrix::word *bits = t->row(r);
+      for (size_t w = 0; w < t->words_per_row(); w++)
+        for (bit_matrix::word x = bits[w]; x != 0; x &= x - 1)
+          f(tile_row * TileSize + r,
+            tile_col * TileSize + w * 64 + std::countr_zero(x));
+    }
+  }
+
+  // row-major order
+  std::vector<std::pair<index, index>> extract_pairs() const {
+    std::vector<std::pair<index, index>> result;
+    for (size_t tile_row = 0; tile_row < tile_rows_; tile_row++) {
+      size_t first = result.size();
+      for (size_t tile_col = 0; tile_col < tile_cols_; tile_col++)
+        for_each_in_tile(tile_row, tile_col,
+                         [&](size_t i, size_t j) { result.emplace_back(i, j); });
+      std::sort(result.begin() + first, result.end());
+    }
+    return result;
+  }
+
+  tiled_matrix &operator|=(const tiled_matrix &other) {
+    for (size_t tile_row = 0; tile_row < tile_rows_; tile_row++)
+      for (size_t tile_col = 0; tile_col < tile_cols_; tile_col++)
+        if (auto tile = other.tile(tile_row, tile_col))
+          *make_tile(tile_row, tile_col) |= *tile;
+    return *this;
+  }
+
+  tiled_matrix &operator&=(const tiled_matrix &other) {
+    for (size_t t = 0; t < tiles_.size(); t++)
+      if (tiles_[t].present()) {
+        if (auto tile = other.tiles_[t].read())
+          *tiles_[t].write(tile->rows(), tile->cols()) &= *tile;
+        else
+          tiles_[t].reset();
+      }
+    drop_empty_tiles();
+    return *this;
+  }
+
+  // removes every entry of other
+  tiled_matrix &subtract(const tiled_matrix &other) {
+    for (size_t t = 0; t < tiles_.size(); t++)
+      if (tiles_[t].present())
+        if (auto tile = other.tiles_[t].read())
+          tiles_[t].write(tile->rows(), tile->cols())->subtract(*tile);
+    drop_empty_tiles();
+    return *this;
+  }
+
+  // diagonal matrix of the columns that have an entry
+  tiled_matrix column_mask() const {
+    tiled_matrix result(cols_, cols_);
+    for (size_t tile_col = 0; tile_col < tile_cols_; tile_col++) {
+      std::vector<bit_matrix::word> used((width(tile_col) + 63) / 64);
+      for (size_t tile_row = 0; tile_row < tile_rows_; tile_row++)
+        if (auto t = tile(tile_row, tile_col))
+          for (size_t r = 0; r < t->rows(); r++)
+            bit_kernels::or_words(used.data(), t->row(r), used.size());
+      for (size_t w = 0; w < used.size(); w++)
+        for (bit_matrix::word x = used[w]; x != 0; x &= x - 1) {
+          size_t j = tile_col * TileSize + w * 64 + std::countr_zero(x);
+          result.set(j, j);
+        }
+    }
+    return result;
+  }
+
+  // sub-matrix of the given size whose top left corner is (row, col)
+  tiled_matrix block(size_t row, size_t col, size_t rows, size_t cols) const {
+    tiled_matrix result(rows, cols);
+    for (auto [i, j] : extract_pairs())
+      if (i >= row && i < row + rows && j >= col && j < col + cols)
+        result.set(i - row, j - col);
+    return result;
+  }
+
+  static tiled_matrix kronecker(const tiled_matrix &left,
+                                const tiled_matrix &right) {
+    tiled_matrix result(left.rows_ * right.rows_, left.cols_ * right.cols_);
+    auto right_pairs = right.extract_pairs();
+    for (auto [i, j] : left.extract_pairs())
+      for (auto [k, l] : right_pairs)
+        result.set(i * right.rows_ + k, j * right.cols_ + l);
+    return result;
+  }
+
+  // result |= left x right tile by tile: result tile (I, J) gets every
+  // left (I, K) x right (K, J) with both tiles present, through the masked
+  // bit_matrix kernel. When fresh is given, the new entries are also set in
+  // it; returns their number. Operands may alias result, they are read from
+  // a snapshot then.
+  static size_t mxm_add(tiled_matrix &result, const tiled_matrix &left,
+                        const tiled_matrix &right, tiled_matrix *fresh) {
+    if (&left == &result || &right == &result) {
+      tiled_matrix snapshot(result);
+      return mxm_add(result, &left == &result ? snapshot : left,
+                     &right == &result ? snapshot : right, fresh);
+    }
+
+    std::atomic<size_t> added = 0;
+    size_t middle = left.tile_cols_;
+    thread_pool::shared().parallel_for(
+        result.tiles_.size(), [&](size_t t) {
+          size_t tile_row = t / result.tile_cols_;
+          size_t tile_col = t % result.tile_cols_;
+          tile_target target{&result, fresh, nullptr, nullptr};
+          size_t count = 0;
+          for (size_t k = 0; k < middle; k++) {
+            if (!left.slot(tile_row, k).present() ||
+                !right.slot(k, tile_col).present())
+              continue;
+            auto a = left.tile(tile_row, k);
+            auto b = right.tile(k, tile_col);
+            count += multiply_tile(*a, {b.get()}, {&target}, tile_row,
+                                   tile_col)[0];
+          }
+          added += count;
+        });
+    return added;
+  }
+
+  struct product_target {
+    tiled_matrix *result;
+    const tiled_matrix *right;
+    tiled_matrix *fresh;
+  };
+
+  // mxm_add of one left operand with several right operands: for every
+  // result tile (I, J) and K, left tile (I, K) is read once by the batched
+  // bit_matrix kernel for all targets whose right tile (K, J) is present. Present right tiles
+  // are indexed first, so sparse targets cost their tiles and not the grid.
+  // Returns the number of new entries per target.
+  static std::vector<size_t>
+  mxm_add_batch(const tiled_matrix &left,
+                std::vector<product_target> targets) {
+    std::deque<tiled_matrix> snapshots;
+    std::map<const tiled_matrix *, const tiled_matrix *> readable;
+    for (const auto &target : targets)
+      readable[target.result] = nullptr;
+    auto snapshot = [&](const tiled_matrix *m) {
+      auto it = readable.find(m);
+      if (it == readable.end())
+        return m;
+      if (it->second == nullptr)
+        it->second = &snapshots.emplace_back(*m);
+      return it->second;
+    };
+    const tiled_matrix &shared = *snapshot(&left);
+    for (auto &target : targets)
+      target.right = snapshot(target.right);
+    if (targets.empty())
+      return {};
+
+    // targets with right tile (K, J) present, by K * tile_cols + J
+    size_t tile_cols = targets.front().right->tile_cols_;
+    std::vector<std::vector<size_t>> present(shared.tile_cols_ * tile_cols);
+    for (size_t i = 0; i < targets.size(); i++)
+      for (size_t t = 0; t < present.size(); t++)
+        if (targets[i].right->tiles_[t].present())
+          present[t].push_back(i);
+
+    std::vector<std::atomic<size_t>> added(targets.size());
+    thread_pool::shared().parallel_for(
+        shared.tile_rows_ * tile_cols, [&](size_t t) {
+          size_t tile_row = t / tile_cols;
+          size_t tile_col = t % tile_cols;
+          // by result, targets into one result write the same tile
+          std::map<tiled_matrix *, tile_target> written;
+          std::vector<std::shared_ptr<const bit_matrix>> held;
+          std::vector<const bit_matrix *> rights;
+          std::vector<tile_target *> members;
+          for (size_t k = 0; k < shared.tile_cols_; k++) {
+            const auto &indices = present[k * tile_cols + tile_col];
+            if (indices.empty() || !shared.slot(tile_row, k).present())
+              continue;
+            held.clear();
+            rights.clear();
+            members.clear();
+            for (size_t i : indices) {
+              held.push_back(targets[i].right->tile(k, tile_col));
+              rights.push_back(held.back().get());
+              auto [it, inserted] = written.try_emplace(
+                  targets[i].result, tile_target{targets[i].result,
+                                                 targets[i].fresh, nullptr,
+                                                 nullptr});
+              members.push_back(&it->second);
+            }
+            auto counts = multiply_tile(*shared.tile(tile_row, k), rights,
+                                        members, tile_row, tile_col);
+            for (size_t p = 0; p < indices.size(); p++)
+              added[indices[p]] += counts[p];
+          }
+        });
+    return std::vector<size_t>(added.begin(), added.end());
+  }
+
+  struct product {
+    tiled_matrix *result;
+    const tiled_matrix *left;
+    const tiled_matrix *right;
+    tiled_matrix *fresh;
+  };
+
+  // mxm_add of many products with operands of their own in one pass: the
+  // products are stacked by result and every (result, tile) pair is one task
+  // of a single parallel loop that runs all products into that tile,
+  // instead of one loop per product. Present left tiles are indexed first. Products of one result
+  // share its fresh matrix. Returns the number of new entries per product.
+  static std::vector<size_t> mxm_add_stacked(std::vector<product> products) {
+    std::deque<tiled_matrix> snapshots;
+    std::map<const tiled_matrix *, const tiled_matrix *> readable;
+    for (const auto &p : products)
+      readable[p.result] = nullptr;
+    auto snapshot = [&](const tiled_matrix *m) {
+      auto it = readable.find(m);
+      if (it == readable.end())
+        return m;
+      if (it->second == nullptr)
+        it->second = &snapshots.emplace_back(*m);
+      return it->second;
+    };
+    for (auto &p : products) {
+      p.left = snapshot(p.left);
+      p.right = snapshot(p.right);
+    }
+
+    // task t is tile t - first[r] of the r-th result; (product, K) with left
+    // tile (I, K) present, by result and I
+    std::map<const tiled_matrix *, size_t> result_of;
+    std::vector<std::vector<std::vector<std::pair<size_t, size_t>>>> present;
+    std::vector<tiled_matrix *> results, freshes;
+    std::vector<size_t> first{0};
+    for (size_t p = 0; p < products.size(); p++) {
+      tiled_matrix *result = products[p].result;
+      auto [it, inserted] = result_of.try_emplace(result, results.size());
+      if (inserted) {
+        results.push_back(result);
+        freshes.push_back(products[p].fresh);
+        present.emplace_back(result->tile_rows_);
+        first.push_back(first.back() + result->tiles_.size());
+      }
+      const tiled_matrix &left = *products[p].left;
+      for (size_t tile_row = 0; tile_row < left.tile_rows_; tile_row++)
+        for (size_t k = 0; k < left.tile_cols_; k++)
+          if (left.slot(tile_row, k).present())
+            present[it->second][tile_row].emplace_back(p, k);
+    }
+
+    std::vector<std::atomic<size_t>> added(products.size());
+    thread_pool::shared().parallel_for(first.back(), [&](size_t task) {
+      size_t r = std::upper_bound(first.begin(), first.end(), task) -
+                 first.begin() - 1;
+      tiled_matrix &result = *results[r];
+      size_t tile_row = (task - first[r]) / result.tile_cols_;
+      size_t tile_col = (task - first[r]) % result.tile_cols_;
+      tile_target target{&result, freshes[r], nullptr, nullptr};
+      for (auto [p, k] : present[r][tile_row]) {
+        const tiled_matrix &right = *products[p].right;
+        if (!right.slot(k, tile_col).present())
+          continue;
+        auto a = products[p].left->tile(tile_row, k);
+        auto b = right.tile(k, tile_col);
+        added[p] += multiply_tile(*a, {b.get()}, {&target}, tile_row,
+                                  tile_col)[0];
+      }
+    });
+    return std::vector<size_t>(added.begin(), added.end());
+  }
+};